@@ -0,0 +1,429 @@
+// Decode benchmark for ffms2.
+//
+// Generates synthetic test media with libavcodec's built-in encoders, then
+// measures indexing time, sequential and random access video decoding and
+// audio decoding throughput. Results are printed to stdout as JSON.
+//
+//     ffms2_bench [--out DIR] [--frames N] [--random N] [--quick]
+
+#include <ffms.h>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/channel_layout.h>
+}
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+struct MediaSpec {
+    const char *   video_codec;
+    AVPixelFormat  pix_fmt;
+    const char *   audio_codec;
+    AVSampleFormat sample_fmt;
+    int            width;
+    int            height;
+    int            gop;
+};
+
+struct BenchOptions {
+    std::string out_dir    = ".";
+    int         frames     = 250;
+    int         random     = 200;
+    bool        quick      = false;
+};
+
+static const int   k_fps         = 25;
+static const int   k_sample_rate = 48000;
+static const int   k_channels    = 2;
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point _start)
+{
+    return std::chrono::duration<double>(Clock::now() - _start).count();
+}
+
+/* ------------------------------------------------------------------------- */
+/*                           synthetic media writer                          */
+/* ------------------------------------------------------------------------- */
+
+struct OutputStream {
+    AVStream *       stream = nullptr;
+    AVCodecContext * ctx    = nullptr;
+    AVFrame *        frame  = nullptr;
+    int64_t          next_pts = 0;
+};
+
+static void close_stream(OutputStream &_os)
+{
+    avcodec_free_context(&_os.ctx);
+    av_frame_free(&_os.frame);
+}
+
+static bool open_stream(AVFormatContext *_fmt, OutputStream &_os, const char *_codec_name, const MediaSpec &_spec, bool _video)
+{
+    const AVCodec *codec = avcodec_find_encoder_by_name(_codec_name);
+    if (!codec) {
+        fprintf(stderr, "encoder %s is not available\n", _codec_name);
+        return false;
+    }
+    _os.stream = avformat_new_stream(_fmt, nullptr);
+    _os.ctx    = avcodec_alloc_context3(codec);
+    _os.frame  = av_frame_alloc();
+    if (!_os.stream || !_os.ctx || !_os.frame)
+        return false;
+
+    AVCodecContext *ctx = _os.ctx;
+    if (_video) {
+        ctx->width         = _spec.width;
+        ctx->height        = _spec.height;
+        ctx->pix_fmt       = _spec.pix_fmt;
+        ctx->time_base     = AVRational{ 1, k_fps };
+        ctx->framerate     = AVRational{ k_fps, 1 };
+        ctx->gop_size      = _spec.gop;
+        ctx->max_b_frames  = (_spec.gop > 2 && (codec->id == AV_CODEC_ID_MPEG4 || codec->id == AV_CODEC_ID_MPEG2VIDEO)) ? 2 : 0;
+        ctx->bit_rate      = (int64_t)_spec.width * _spec.height * 4;
+        ctx->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+    }
+    else {
+        ctx->sample_fmt     = _spec.sample_fmt;
+        ctx->sample_rate    = k_sample_rate;
+        ctx->channels       = k_channels;
+        ctx->channel_layout = av_get_default_channel_layout(k_channels);
+        ctx->time_base      = AVRational{ 1, k_sample_rate };
+    }
+    if (_fmt->oformat->flags & AVFMT_GLOBALHEADER)
+        ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+    if (avcodec_open2(ctx, codec, nullptr) < 0) {
+        fprintf(stderr, "could not open encoder %s\n", _codec_name);
+        return false;
+    }
+    if (avcodec_parameters_from_context(_os.stream->codecpar, ctx) < 0)
+        return false;
+    _os.stream->time_base = ctx->time_base;
+
+    AVFrame *frame = _os.frame;
+    if (_video) {
+        frame->format = ctx->pix_fmt;
+        frame->width  = ctx->width;
+        frame->height = ctx->height;
+    }
+    else {
+        frame->format         = ctx->sample_fmt;
+        frame->channel_layout = ctx->channel_layout;
+        frame->sample_rate    = ctx->sample_rate;
+        frame->nb_samples     = ctx->frame_size ? ctx->frame_size : 1024;
+    }
+    return av_frame_get_buffer(frame, 0) >= 0;
+}
+
+static bool encode(AVFormatContext *_fmt, OutputStream &_os, AVFrame *_frame)
+{
+    if (avcodec_send_frame(_os.ctx, _frame) < 0)
+        return false;
+    AVPacket *pkt = av_packet_alloc();
+    int ret;
+    while ((ret = avcodec_receive_packet(_os.ctx, pkt)) >= 0) {
+        av_packet_rescale_ts(pkt, _os.ctx->time_base, _os.stream->time_base);
+        pkt->stream_index = _os.stream->index;
+        if (av_interleaved_write_frame(_fmt, pkt) < 0) {
+            av_packet_free(&pkt);
+            return false;
+        }
+    }
+    av_packet_free(&pkt);
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF;
+}
+
+// Moving gradients with a hard cut every 100 frames so that decoders have
+// real motion and intra content to deal with
+static void fill_video_frame(AVFrame *_frame, int _n)
+{
+    av_frame_make_writable(_frame);
+    const int scene = _n / 100;
+    for (int y = 0; y < _frame->height; y++) {
+        uint8_t *row = _frame->data[0] + (ptrdiff_t)y * _frame->linesize[0];
+        for (int x = 0; x < _frame->width; x++)
+            row[x] = (uint8_t)(x + y * (scene + 1) + _n * 3);
+    }
+    for (int y = 0; y < (_frame->height + 1) / 2; y++) {
+        uint8_t *u = _frame->data[1] + (ptrdiff_t)y * _frame->linesize[1];
+        uint8_t *v = _frame->data[2] + (ptrdiff_t)y * _frame->linesize[2];
+        for (int x = 0; x < (_frame->width + 1) / 2; x++) {
+            u[x] = (uint8_t)(128 + y + _n * 2 + scene * 40);
+            v[x] = (uint8_t)(64 + x + _n * 5);
+        }
+    }
+    _frame->pts = _n;
+}
+
+static void fill_audio_frame(AVFrame *_frame, int64_t _pts)
+{
+    av_frame_make_writable(_frame);
+    int16_t *samples = (int16_t *)_frame->data[0];
+    for (int i = 0; i < _frame->nb_samples; i++) {
+        double t    = (double)(_pts + i) / k_sample_rate;
+        double freq = 220.0 + 40.0 * t;
+        for (int c = 0; c < k_channels; c++)
+            samples[i * k_channels + c] = (int16_t)(8000.0 * sin(6.283185307179586 * freq * t * (c + 1)));
+    }
+    _frame->pts = _pts;
+}
+
+static bool write_media(const std::string &_path, const MediaSpec &_spec, int _frames)
+{
+    AVFormatContext *fmt = nullptr;
+    if (avformat_alloc_output_context2(&fmt, nullptr, "matroska", _path.c_str()) < 0)
+        return false;
+
+    OutputStream video, audio;
+    bool ok = open_stream(fmt, video, _spec.video_codec, _spec, true) &&
+              open_stream(fmt, audio, _spec.audio_codec, _spec, false) &&
+              avio_open(&fmt->pb, _path.c_str(), AVIO_FLAG_WRITE) >= 0 &&
+              avformat_write_header(fmt, nullptr) >= 0;
+
+    for (int n = 0; ok && n < _frames; n++) {
+        fill_video_frame(video.frame, n);
+        ok = encode(fmt, video, video.frame);
+        // Keep the audio a frame ahead of the video for sane interleaving
+        while (ok && audio.next_pts * k_fps < (int64_t)(n + 1) * k_sample_rate) {
+            fill_audio_frame(audio.frame, audio.next_pts);
+            audio.next_pts += audio.frame->nb_samples;
+            ok = encode(fmt, audio, audio.frame);
+        }
+    }
+    if (ok)
+        ok = encode(fmt, video, nullptr) && encode(fmt, audio, nullptr) && av_write_trailer(fmt) >= 0;
+
+    close_stream(video);
+    close_stream(audio);
+    if (fmt->pb)
+        avio_closep(&fmt->pb);
+    avformat_free_context(fmt);
+    return ok;
+}
+
+/* ------------------------------------------------------------------------- */
+/*                                measurements                               */
+/* ------------------------------------------------------------------------- */
+
+struct BenchResult {
+    std::string name;
+    MediaSpec   spec;
+    int         frames            = 0;
+    double      index_seconds     = 0;
+    double      sequential_fps    = 0;
+    double      random_p50_ms     = 0;
+    double      random_p90_ms     = 0;
+    double      random_p99_ms     = 0;
+    int         random_requests   = 0;
+    int         random_seeks      = 0;
+    double      audio_samples_per_second = 0;
+    double      audio_mb_per_second      = 0;
+};
+
+static double percentile(std::vector<double> _values, double _p)
+{
+    if (_values.empty())
+        return 0;
+    std::sort(_values.begin(), _values.end());
+    size_t idx = (size_t)std::lround(_p * (_values.size() - 1));
+    return _values[idx];
+}
+
+static bool report_error(const char *_what, const FFMS_ErrorInfo &_err)
+{
+    fprintf(stderr, "%s: %s\n", _what, _err.Buffer);
+    return false;
+}
+
+static bool run_bench(const std::string &_path, const BenchOptions &_opts, BenchResult &_result)
+{
+    char           errmsg[1024];
+    FFMS_ErrorInfo err;
+    err.Buffer     = errmsg;
+    err.BufferSize = sizeof(errmsg);
+    err.ErrorType  = FFMS_ERROR_SUCCESS;
+    err.SubType    = FFMS_ERROR_SUCCESS;
+
+    // index
+    auto start = Clock::now();
+    FFMS_Indexer *indexer = FFMS_CreateIndexer(_path.c_str(), &err);
+    if (!indexer)
+        return report_error("create indexer", err);
+    FFMS_TrackTypeIndexSettings(indexer, FFMS_TYPE_AUDIO, 1, 0);
+    FFMS_Index *index = FFMS_DoIndexing2(indexer, FFMS_IEH_ABORT, &err);
+    if (!index)
+        return report_error("index", err);
+    _result.index_seconds = seconds_since(start);
+
+    int video_track = FFMS_GetFirstTrackOfType(index, FFMS_TYPE_VIDEO, &err);
+    int audio_track = FFMS_GetFirstTrackOfType(index, FFMS_TYPE_AUDIO, &err);
+    bool ok = video_track >= 0 && audio_track >= 0;
+
+    // sequential video
+    if (ok) {
+        FFMS_VideoSource *video = FFMS_CreateVideoSource(_path.c_str(), video_track, index, 1, FFMS_SEEK_NORMAL, &err);
+        ok = video != nullptr;
+        if (ok) {
+            int num_frames = FFMS_GetVideoProperties(video)->NumFrames;
+            _result.frames = num_frames;
+            start = Clock::now();
+            for (int n = 0; ok && n < num_frames; n++)
+                ok = FFMS_GetFrame(video, n, &err) != nullptr;
+            double elapsed = seconds_since(start);
+            _result.sequential_fps = elapsed > 0 ? num_frames / elapsed : 0;
+            FFMS_DestroyVideoSource(video);
+        }
+    }
+
+    // random access video, with a fixed seed so runs are comparable
+    if (ok) {
+        FFMS_VideoSource *video = FFMS_CreateVideoSource(_path.c_str(), video_track, index, 1, FFMS_SEEK_NORMAL, &err);
+        ok = video != nullptr;
+        if (ok) {
+            int num_frames = FFMS_GetVideoProperties(video)->NumFrames;
+            std::mt19937 rng(12345);
+            std::uniform_int_distribution<int> dist(0, num_frames - 1);
+            std::vector<double> latencies;
+            int seeks_before = FFMS_GetVideoSeekCount(video);
+            for (int i = 0; ok && i < _opts.random; i++) {
+                int n = dist(rng);
+                start = Clock::now();
+                ok = FFMS_GetFrame(video, n, &err) != nullptr;
+                latencies.push_back(seconds_since(start) * 1000.0);
+            }
+            _result.random_requests = (int)latencies.size();
+            _result.random_seeks    = FFMS_GetVideoSeekCount(video) - seeks_before;
+            _result.random_p50_ms   = percentile(latencies, 0.50);
+            _result.random_p90_ms   = percentile(latencies, 0.90);
+            _result.random_p99_ms   = percentile(latencies, 0.99);
+            FFMS_DestroyVideoSource(video);
+        }
+    }
+
+    // audio throughput
+    if (ok) {
+        FFMS_AudioSource *audio = FFMS_CreateAudioSource(_path.c_str(), audio_track, index, FFMS_DELAY_FIRST_VIDEO_TRACK, &err);
+        ok = audio != nullptr;
+        if (ok) {
+            const FFMS_AudioProperties *props = FFMS_GetAudioProperties(audio);
+            const int64_t chunk = 4096;
+            const size_t bytes_per_sample = av_get_bytes_per_sample((AVSampleFormat)props->SampleFormat) * props->Channels;
+            std::vector<uint8_t> buf(chunk * bytes_per_sample);
+            start = Clock::now();
+            for (int64_t pos = 0; ok && pos < props->NumSamples; pos += chunk)
+                ok = FFMS_GetAudio(audio, buf.data(), pos, std::min(chunk, props->NumSamples - pos), &err) == 0;
+            double elapsed = seconds_since(start);
+            if (elapsed > 0) {
+                _result.audio_samples_per_second = props->NumSamples / elapsed;
+                _result.audio_mb_per_second      = props->NumSamples * bytes_per_sample / elapsed / (1024.0 * 1024.0);
+            }
+            FFMS_DestroyAudioSource(audio);
+        }
+    }
+
+    FFMS_DestroyIndex(index);
+    if (!ok)
+        return report_error(_path.c_str(), err);
+    return true;
+}
+
+static void print_results(const std::vector<BenchResult> &_results)
+{
+    printf("{\n  \"ffms_version\": %d,\n  \"results\": [\n", FFMS_GetVersion());
+    for (size_t i = 0; i < _results.size(); i++) {
+        const BenchResult &r = _results[i];
+        printf("    {\n");
+        printf("      \"name\": \"%s\",\n", r.name.c_str());
+        printf("      \"video_codec\": \"%s\",\n", r.spec.video_codec);
+        printf("      \"audio_codec\": \"%s\",\n", r.spec.audio_codec);
+        printf("      \"width\": %d,\n", r.spec.width);
+        printf("      \"height\": %d,\n", r.spec.height);
+        printf("      \"gop\": %d,\n", r.spec.gop);
+        printf("      \"frames\": %d,\n", r.frames);
+        printf("      \"index_seconds\": %.6f,\n", r.index_seconds);
+        printf("      \"sequential_fps\": %.3f,\n", r.sequential_fps);
+        printf("      \"random_requests\": %d,\n", r.random_requests);
+        printf("      \"random_seeks\": %d,\n", r.random_seeks);
+        printf("      \"random_p50_ms\": %.3f,\n", r.random_p50_ms);
+        printf("      \"random_p90_ms\": %.3f,\n", r.random_p90_ms);
+        printf("      \"random_p99_ms\": %.3f,\n", r.random_p99_ms);
+        printf("      \"audio_samples_per_second\": %.1f,\n", r.audio_samples_per_second);
+        printf("      \"audio_mb_per_second\": %.3f\n", r.audio_mb_per_second);
+        printf("    }%s\n", i + 1 < _results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions opts;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--out") && i + 1 < argc)
+            opts.out_dir = argv[++i];
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+            opts.frames = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--random") && i + 1 < argc)
+            opts.random = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--quick"))
+            opts.quick = true;
+        else {
+            fprintf(stderr, "usage: %s [--out DIR] [--frames N] [--random N] [--quick]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    FFMS_Init(0, 0);
+    FFMS_SetLogLevel(FFMS_LOG_ERROR);
+
+    struct Resolution { int width, height; };
+    std::vector<Resolution> resolutions = { { 320, 240 }, { 1280, 720 } };
+    std::vector<int>        gops        = { 12, 60, 250 };
+    if (opts.quick) {
+        resolutions.resize(1);
+        gops.resize(1);
+    }
+
+    std::vector<MediaSpec> specs;
+    for (const Resolution &res : resolutions) {
+        for (int gop : gops) {
+            specs.push_back({ "mpeg4",      AV_PIX_FMT_YUV420P, "flac",      AV_SAMPLE_FMT_S16, res.width, res.height, gop });
+            specs.push_back({ "mpeg2video", AV_PIX_FMT_YUV420P, "pcm_s16le", AV_SAMPLE_FMT_S16, res.width, res.height, gop });
+            specs.push_back({ "ffv1",       AV_PIX_FMT_YUV420P, "flac",      AV_SAMPLE_FMT_S16, res.width, res.height, gop });
+        }
+        // intra only, so the gop length makes no difference
+        specs.push_back({ "mjpeg", AV_PIX_FMT_YUVJ420P, "pcm_s16le", AV_SAMPLE_FMT_S16, res.width, res.height, 1 });
+    }
+
+    std::vector<BenchResult> results;
+    for (const MediaSpec &spec : specs) {
+        BenchResult result;
+        result.spec = spec;
+        result.name = std::string(spec.video_codec) + "_" + spec.audio_codec + "_" +
+                      std::to_string(spec.width) + "x" + std::to_string(spec.height) + "_g" + std::to_string(spec.gop);
+        std::string path = opts.out_dir + "/ffms2_bench_" + result.name + ".mkv";
+        fprintf(stderr, "%s\n", result.name.c_str());
+
+        if (!write_media(path, spec, opts.frames)) {
+            fprintf(stderr, "failed to write %s, skipping\n", path.c_str());
+            continue;
+        }
+        if (run_bench(path, opts, result))
+            results.push_back(result);
+        remove(path.c_str());
+    }
+
+    print_results(results);
+    return results.size() == specs.size() ? 0 : 1;
+}
@@ -22,7 +22,7 @@
 #define FFMS_H
 
 // Version format: major - minor - micro - bump
-#define FFMS_VERSION ((2 << 24) | (40 << 16) | (0 << 8) | 0)
+#define FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0)
 
 #include <stdint.h>
 #include <stddef.h>
@@ -160,7 +160,13 @@ typedef enum FFMS_SampleFormat {
     FFMS_FMT_S16,
     FFMS_FMT_S32,
     FFMS_FMT_FLT,
-    FFMS_FMT_DBL
+    FFMS_FMT_DBL,
+    /* Planar formats are only valid as output formats. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+    FFMS_FMT_U8P,
+    FFMS_FMT_S16P,
+    FFMS_FMT_S32P,
+    FFMS_FMT_FLTP,
+    FFMS_FMT_DBLP
 } FFMS_SampleFormat;
 
 typedef enum FFMS_AudioChannel {
@@ -279,6 +285,21 @@ typedef enum FFMS_LogLevels {
     FFMS_LOG_TRACE = 56
 } FFMS_LogLevels;
 
+typedef enum FFMS_TensorLayout {
+    FFMS_TENSOR_LAYOUT_CHW = 0, /* planar, one Height x Width plane per channel */
+    FFMS_TENSOR_LAYOUT_HWC = 1  /* interleaved, channels are the innermost dimension */
+} FFMS_TensorLayout;
+
+typedef enum FFMS_TensorDataType {
+    FFMS_TENSOR_FLOAT32 = 0,
+    FFMS_TENSOR_FLOAT16 = 1 /* IEEE 754 half precision, stored as uint16_t */
+} FFMS_TensorDataType;
+
+typedef enum FFMS_SamplePolicy {
+    FFMS_SAMPLE_EXACT = 0,           /* exactly the evenly spaced frames */
+    FFMS_SAMPLE_NEAREST_KEYFRAME = 1 /* the closest keyframe within Tolerance frames if there is one */
+} FFMS_SamplePolicy;
+
 typedef struct FFMS_ResampleOptions {
     int64_t ChannelLayout;
     FFMS_SampleFormat SampleFormat;
@@ -299,6 +320,51 @@ typedef struct FFMS_ResampleOptions {
     FFMS_AudioDitherMethod DitherMethod;
 } FFMS_ResampleOptions;
 
+/* Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+typedef struct FFMS_TensorOptions {
+    int Width;
+    int Height;
+    int Resizer; /* FFMS_Resizers, 0 selects bicubic */
+    FFMS_TensorLayout Layout;
+    FFMS_TensorDataType DataType;
+    /* Channels are always R, G, B and each output value is ((x * Scale) - Mean[c]) / Std[c] for 8-bit input x */
+    float Scale;
+    float Mean[3];
+    float Std[3];
+} FFMS_TensorOptions;
+
+/* Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+typedef struct FFMS_AudioSpan {
+    const uint8_t *Data; /* NULL for silence before the start of the audio */
+    int64_t PlaneStride; /* Distance in bytes between the channels of planar formats */
+    int64_t Start;
+    int64_t SampleCount;
+} FFMS_AudioSpan;
+
+/* Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+typedef struct FFMS_AudioPeak {
+    float Min;
+    float Max;
+    float RMS;
+} FFMS_AudioPeak;
+
+/* Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+typedef struct FFMS_SpectrogramOptions {
+    int WindowSize;     /* samples per frame and FFT size, a power of two from 16 to 65536 */
+    int HopSize;        /* samples between the starts of consecutive frames */
+    int MelBands;       /* 0 for the magnitudes of the WindowSize / 2 + 1 FFT bins, otherwise the number of log-mel bands */
+    float MinFrequency; /* range of the mel filterbank in Hz, MaxFrequency 0 for half the sample rate */
+    float MaxFrequency;
+    float LogFloor;     /* mel band energies are output as log(max(x, LogFloor)), 0 selects 1e-10 */
+} FFMS_SpectrogramOptions;
+
+/* Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+typedef struct FFMS_AudioRange {
+    void *Buf;          /* receives Count samples laid out as for FFMS_GetAudio */
+    int64_t Start;
+    int64_t Count;
+} FFMS_AudioRange;
+
 
 typedef struct FFMS_Frame {
     const uint8_t *Data[4];
@@ -400,6 +466,10 @@ typedef struct FFMS_AudioProperties {
 } FFMS_AudioProperties;
 
 typedef int (FFMS_CC *TIndexCallback)(int64_t Current, int64_t Total, void *ICPrivate);
+typedef int (FFMS_CC *TFrameSampleCallback)(int Sample, int FrameNumber, const FFMS_Frame *Frame, void *SCPrivate); /* Return non-zero to stop sampling. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+typedef int (FFMS_CC *TAudioSinkCallback)(int Track, const FFMS_AudioProperties *AP, const void *Samples, int64_t Start, int64_t Count, void *SinkPrivate); /* Samples are packed in the format described by AP. Return non-zero to stop extracting. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+typedef int (FFMS_CC *TBatchIndexCallback)(int File, int64_t Bytes, double Seconds, const FFMS_ErrorInfo *FileError, void *BIPrivate); /* Called once per file from one thread at a time, with FileError->ErrorType FFMS_ERROR_SUCCESS if it was indexed. Return non-zero to skip the files not yet started. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+typedef int (FFMS_CC *TIndexSnapshotCallback)(FFMS_Index *Snapshot, void *SCPrivate); /* The callback owns Snapshot and has to free it with FFMS_DestroyIndex. Return non-zero to cancel indexing. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
 
 /* Most functions return 0 on success */
 /* Functions without error message output can be assumed to never fail in a graceful way */
@@ -408,6 +478,7 @@ FFMS_API(void) FFMS_Deinit();
 FFMS_API(int) FFMS_GetVersion();
 FFMS_API(int) FFMS_GetLogLevel();
 FFMS_API(void) FFMS_SetLogLevel(int Level);
+FFMS_API(int) FFMS_SetFramePool(int Alignment, int HugePages, FFMS_ErrorInfo *ErrorInfo); /* Alignment must be 0 (disabled) or a power of two no larger than 4096, values below 16 are rounded up to 16, affects sources created afterwards. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
 FFMS_API(FFMS_VideoSource *) FFMS_CreateVideoSource(const char *SourceFile, int Track, FFMS_Index *Index, int Threads, int SeekMode, FFMS_ErrorInfo *ErrorInfo);
 FFMS_API(FFMS_AudioSource *) FFMS_CreateAudioSource(const char *SourceFile, int Track, FFMS_Index *Index, int DelayMode, FFMS_ErrorInfo *ErrorInfo);
 FFMS_API(void) FFMS_DestroyVideoSource(FFMS_VideoSource *V);
@@ -416,7 +487,7 @@ FFMS_API(const FFMS_VideoProperties *) FFMS_GetVideoProperties(FFMS_VideoSource
 FFMS_API(const FFMS_AudioProperties *) FFMS_GetAudioProperties(FFMS_AudioSource *A);
 FFMS_API(const FFMS_Frame *) FFMS_GetFrame(FFMS_VideoSource *V, int n, FFMS_ErrorInfo *ErrorInfo);
 FFMS_API(const FFMS_Frame *) FFMS_GetFrameByTime(FFMS_VideoSource *V, double Time, FFMS_ErrorInfo *ErrorInfo);
-FFMS_API(int) FFMS_GetAudio(FFMS_AudioSource *A, void *Buf, int64_t Start, int64_t Count, FFMS_ErrorInfo *ErrorInfo);
+FFMS_API(int) FFMS_GetAudio(FFMS_AudioSource *A, void *Buf, int64_t Start, int64_t Count, FFMS_ErrorInfo *ErrorInfo); /* Planar output formats store one plane of Count samples per channel after each other in Buf */
 FFMS_API(int) FFMS_SetOutputFormatV2(FFMS_VideoSource *V, const int *TargetFormats, int Width, int Height, int Resizer, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (15 << 16) | (3 << 8) | 0) */
 FFMS_API(void) FFMS_ResetOutputFormatV(FFMS_VideoSource *V);
 FFMS_API(int) FFMS_SetInputFormatV(FFMS_VideoSource *V, int ColorSpace, int ColorRange, int Format, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 0) */
@@ -454,4 +525,35 @@ FFMS_API(int) FFMS_WriteIndex(const char *IndexFile, FFMS_Index *Index, FFMS_Err
 FFMS_API(int) FFMS_WriteIndexToBuffer(uint8_t **BufferPtr, size_t *Size, FFMS_Index *Index, FFMS_ErrorInfo *ErrorInfo);
 FFMS_API(void) FFMS_FreeIndexBuffer(uint8_t **BufferPtr);
 FFMS_API(int) FFMS_GetPixFmt(const char *Name);
+FFMS_API(int) FFMS_SetTensorOutputV(FFMS_VideoSource *V, const FFMS_TensorOptions *Options, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(size_t) FFMS_GetTensorSize(FFMS_VideoSource *V); /* Size in bytes of one frame's tensor, 0 if no tensor output is set. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(int) FFMS_GetFrameTensor(FFMS_VideoSource *V, int n, void *Buf, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(int) FFMS_GetFrameTensorBatch(FFMS_VideoSource *V, const int *FrameNumbers, int NumFrames, void *Buf, FFMS_ErrorInfo *ErrorInfo); /* Writes frame FrameNumbers[i] into slot i of an N-major tensor. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(int) FFMS_PlanSampleFrames(FFMS_VideoSource *V, int Count, int Stride, int Policy, int Tolerance, int *FrameNumbers, int MaxFrames, FFMS_ErrorInfo *ErrorInfo); /* Pass Count > 0 for evenly spaced frames or Stride > 0 for every Stride:th frame. Writes at most MaxFrames frame numbers and returns the total number planned, or -1 on error. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(int) FFMS_SampleFrames(FFMS_VideoSource *V, int Count, int Stride, int Policy, int Tolerance, TFrameSampleCallback SC, void *SCPrivate, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(void) FFMS_SetSceneDetectionV(FFMS_VideoSource *V, int Enable); /* Scores consecutive frames as they're decoded. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(int) FFMS_GetSceneScores(FFMS_VideoSource *V, float *Scores, int NumScores); /* Scores are in [0, 1] with -1 for frames not yet scored, returns the number of scored frames. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(int) FFMS_WriteSceneScores(FFMS_VideoSource *V, const char *SceneFile, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(int) FFMS_ReadSceneScores(FFMS_VideoSource *V, const char *SceneFile, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(void) FFMS_SetAudioCacheBudget(FFMS_AudioSource *A, int64_t Bytes); /* Memory used by the decoded audio cache, including the buffers it keeps for reuse but not the always cached beginning of the file. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(void) FFMS_SetGlobalAudioCacheLimit(int64_t Bytes); /* Combined size of the caches of all audio sources, not counting the always cached beginnings of the files, 0 for no limit. Once it is reached sources stop adding to their caches. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(int) FFMS_GetAudioSpans(FFMS_AudioSource *A, int64_t Start, int64_t Count, FFMS_AudioSpan *Spans, int MaxSpans, int *NumSpans, FFMS_ErrorInfo *ErrorInfo); /* Returns pointers into the audio cache which stay valid until FFMS_ReleaseAudioSpans. If MaxSpans is too small only the beginning of the range is covered. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(void) FFMS_ReleaseAudioSpans(FFMS_AudioSource *A); /* Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(int) FFMS_SetAudioPrefetch(FFMS_AudioSource *A, int64_t Samples, FFMS_ErrorInfo *ErrorInfo); /* Decodes up to Samples samples past the last read on a background thread, 0 to disable. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(int) FFMS_GetAudioParallel(FFMS_AudioSource *A, void *Buf, int64_t Start, int64_t Count, int Threads, FFMS_ErrorInfo *ErrorInfo); /* Same as FFMS_GetAudio but splits long ranges between up to Threads decoders, 0 for one per core. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(int) FFMS_SetAudioSidecar(FFMS_AudioSource *A, const char *SidecarFile, FFMS_ErrorInfo *ErrorInfo); /* Decodes the whole track in the current output format to SidecarFile unless it already holds it, then serves all reads from it memory mapped. Pass NULL to stop using it. Changing the output format also stops using it. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(void) FFMS_SetAudioPeakIndexing(FFMS_Indexer *Indexer, int BlockSize); /* Computes min, max and RMS peaks of every BlockSize samples of the indexed audio tracks while indexing, 0 to disable. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(int) FFMS_GetAudioPeakChannels(FFMS_Track *T); /* 0 if the track has no peaks. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(int) FFMS_GetAudioPeaks(FFMS_Track *T, int64_t Start, int64_t Count, int NumPeaks, FFMS_AudioPeak *Peaks, FFMS_ErrorInfo *ErrorInfo); /* Fills Peaks with NumPeaks peaks per channel, interleaved by channel, evenly covering Count samples from Start. Positions are in samples of the decoded track, without delay or resampling. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(int) FFMS_GetSpectrogramBins(const FFMS_SpectrogramOptions *Options); /* Values per spectrogram frame, 0 if the options are invalid. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(int) FFMS_GetSpectrogram(FFMS_AudioSource *A, const FFMS_SpectrogramOptions *Options, int64_t Start, int NumFrames, float *Out, FFMS_ErrorInfo *ErrorInfo); /* Frame i covers WindowSize samples from Start + i * HopSize, mixed down to mono. Out holds NumFrames * FFMS_GetSpectrogramBins values. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(int) FFMS_GetSpectrogramBatch(FFMS_AudioSource *A, const FFMS_SpectrogramOptions *Options, const int64_t *Starts, const int *NumFrames, int NumRanges, float *Out, FFMS_ErrorInfo *ErrorInfo); /* Computes the frames of each range one after another. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(int) FFMS_ExtractAudioTracks(const char *SourceFile, FFMS_Index *Index, const int *Tracks, int NumTracks, TAudioSinkCallback Sink, void *SinkPrivate, FFMS_ErrorInfo *ErrorInfo); /* Decodes the given audio tracks, or all indexed ones if NumTracks is 0, in a single pass over the file. Start is the position in the track without any delay applied. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(int) FFMS_GetAudioRange(FFMS_AudioSource *A, void *Buf, double StartTime, double EndTime, int64_t MaxSamples, int64_t *NumSamples, FFMS_ErrorInfo *ErrorInfo); /* Reads the samples played from StartTime up to EndTime, in seconds on the same timeline as the frame PTS, with the delay mode applied. Consecutive ranges never overlap or leave gaps. Pass NULL for Buf to only get the number of samples. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(int) FFMS_GetAudioBatch(FFMS_AudioSource *A, const FFMS_AudioRange *Ranges, int NumRanges, FFMS_ErrorInfo *ErrorInfo); /* Reads the ranges in order of position rather than in the order given, so the file is decoded in a single forward pass which only seeks over gaps longer than the decoder pre-roll. Ranges may overlap. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(int) FFMS_IndexFiles(const char **SourceFiles, const char **IndexFiles, int NumFiles, int IndexAudio, int ErrorHandling, int Threads, TBatchIndexCallback BIC, void *BIPrivate, FFMS_ErrorInfo *ErrorInfo); /* Indexes the files on Threads worker threads, 0 for one per core, with one file open per thread. Indexes are written to IndexFiles, or next to the source files with .ffindex appended if it is NULL. Files which fail don't stop the batch and are only reported to the callback. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(void) FFMS_SetFastAudioIndexing(FFMS_Indexer *Indexer, int Enable); /* Takes audio sample counts from the codec frame size or packet durations instead of decoding every packet, for tracks where the first packet shows they agree with the decoder. Packets are still run through the codec parser where there is one, and decoding resumes when it sees the channel count or sample rate change. Has no effect on tracks with peak indexing. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(FFMS_Index *) FFMS_UpdateIndex(FFMS_Indexer *Indexer, FFMS_Index *Existing, int ErrorHandling, FFMS_ErrorInfo *ErrorInfo); /* Like FFMS_DoIndexing2, but if Existing was made from the file before more data was appended to it, only the new packets and a few before them are read and indexed. Falls back to indexing the whole file if the beginning changed or different tracks are indexed. Existing is left unchanged. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(void) FFMS_SetIndexSnapshotCallback(FFMS_Indexer *Indexer, int Interval, TIndexSnapshotCallback SC, void *SCPrivate); /* Passes a finalized copy of the index so far to SC after the first Interval indexed packets, and from then on whenever twice as many packets as in the previous gap have been indexed, so the snapshots cost about as much as indexing once more in total. Sources can be opened from the snapshots while indexing continues. Video tracks in them end before their last keyframe so that every GOP is complete. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
+FFMS_API(int) FFMS_GetVideoSeekCount(FFMS_VideoSource *V); /* Number of times the source has seeked in the file since it was created, for measuring the cost of random access. Introduced in FFMS_VERSION ((2 << 24) | (41 << 16) | (0 << 8) | 0) */
 #endif
@@ -35,4 +35,10 @@
 #       define FFMS_REGISTER()
 #endif
 
+#if VERSION_CHECK(LIBAVUTIL_VERSION_INT, <, 57, 0, 100)
+        typedef int ffms_buffer_size_t;
+#else
+        typedef size_t ffms_buffer_size_t;
+#endif
+
 #endif // FFMSCOMPAT_H
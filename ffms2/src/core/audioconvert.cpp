@@ -0,0 +1,279 @@
+//  Copyright (c) 2026 The FFmpegSource Project
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "audioconvert.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+inline void ConvertSample(int16_t In, int16_t &Out) { Out = In; }
+inline void ConvertSample(int16_t In, int32_t &Out) { Out = static_cast<int32_t>(In) * 65536; }
+inline void ConvertSample(int16_t In, float &Out) { Out = In * (1.0f / 32768.0f); }
+inline void ConvertSample(int32_t In, int16_t &Out) { Out = static_cast<int16_t>(In >> 16); }
+inline void ConvertSample(int32_t In, int32_t &Out) { Out = In; }
+inline void ConvertSample(int32_t In, float &Out) { Out = In * (1.0f / 2147483648.0f); }
+inline void ConvertSample(float In, int16_t &Out) {
+    Out = static_cast<int16_t>(std::min(std::max(lrintf(In * 32768.0f), -32768L), 32767L));
+}
+inline void ConvertSample(float In, int32_t &Out) {
+    Out = static_cast<int32_t>(std::min(std::max(llrintf(In * 2147483648.0f), -2147483647LL - 1), 2147483647LL));
+}
+inline void ConvertSample(float In, float &Out) { Out = In; }
+inline void ConvertSample(uint8_t In, uint8_t &Out) { Out = In; }
+inline void ConvertSample(double In, double &Out) { Out = In; }
+
+// Converts a contiguous run of samples
+template<typename In, typename Out>
+void ConvertRun(const In *Src, Out *Dst, size_t Count) {
+    for (size_t i = 0; i < Count; i++)
+        ConvertSample(Src[i], Dst[i]);
+}
+
+template<typename T>
+void CopyRun(const T *Src, T *Dst, size_t Count) {
+    memcpy(Dst, Src, Count * sizeof(T));
+}
+
+template<> void ConvertRun(const uint8_t *Src, uint8_t *Dst, size_t Count) { CopyRun(Src, Dst, Count); }
+template<> void ConvertRun(const int16_t *Src, int16_t *Dst, size_t Count) { CopyRun(Src, Dst, Count); }
+template<> void ConvertRun(const int32_t *Src, int32_t *Dst, size_t Count) { CopyRun(Src, Dst, Count); }
+template<> void ConvertRun(const float *Src, float *Dst, size_t Count) { CopyRun(Src, Dst, Count); }
+template<> void ConvertRun(const double *Src, double *Dst, size_t Count) { CopyRun(Src, Dst, Count); }
+
+#ifdef FFMS_SSE2
+template<> void ConvertRun(const float *Src, int16_t *Dst, size_t Count) {
+    const __m128 Scale = _mm_set1_ps(32768.0f);
+    const __m128 Min = _mm_set1_ps(-32768.0f);
+    const __m128 Max = _mm_set1_ps(32767.0f);
+    size_t i = 0;
+    for (; i + 8 <= Count; i += 8) {
+        __m128 A = _mm_mul_ps(_mm_loadu_ps(Src + i), Scale);
+        __m128 B = _mm_mul_ps(_mm_loadu_ps(Src + i + 4), Scale);
+        A = _mm_min_ps(_mm_max_ps(A, Min), Max);
+        B = _mm_min_ps(_mm_max_ps(B, Min), Max);
+        __m128i Packed = _mm_packs_epi32(_mm_cvtps_epi32(A), _mm_cvtps_epi32(B));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(Dst + i), Packed);
+    }
+    for (; i < Count; i++)
+        ConvertSample(Src[i], Dst[i]);
+}
+
+template<> void ConvertRun(const float *Src, int32_t *Dst, size_t Count) {
+    const __m128 Scale = _mm_set1_ps(2147483648.0f);
+    size_t i = 0;
+    for (; i + 4 <= Count; i += 4) {
+        __m128 A = _mm_mul_ps(_mm_loadu_ps(Src + i), Scale);
+        // cvtps returns INT32_MIN on overflow, which is right for negative
+        // values and gets flipped to INT32_MAX for positive ones
+        __m128i Overflow = _mm_castps_si128(_mm_cmpge_ps(A, Scale));
+        __m128i Result = _mm_xor_si128(_mm_cvtps_epi32(A), Overflow);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(Dst + i), Result);
+    }
+    for (; i < Count; i++)
+        ConvertSample(Src[i], Dst[i]);
+}
+
+template<> void ConvertRun(const int16_t *Src, float *Dst, size_t Count) {
+    const __m128 Scale = _mm_set1_ps(1.0f / 32768.0f);
+    size_t i = 0;
+    for (; i + 8 <= Count; i += 8) {
+        __m128i Samples = _mm_loadu_si128(reinterpret_cast<const __m128i *>(Src + i));
+        __m128i Lo = _mm_srai_epi32(_mm_unpacklo_epi16(Samples, Samples), 16);
+        __m128i Hi = _mm_srai_epi32(_mm_unpackhi_epi16(Samples, Samples), 16);
+        _mm_storeu_ps(Dst + i, _mm_mul_ps(_mm_cvtepi32_ps(Lo), Scale));
+        _mm_storeu_ps(Dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(Hi), Scale));
+    }
+    for (; i < Count; i++)
+        ConvertSample(Src[i], Dst[i]);
+}
+
+template<> void ConvertRun(const int32_t *Src, float *Dst, size_t Count) {
+    const __m128 Scale = _mm_set1_ps(1.0f / 2147483648.0f);
+    size_t i = 0;
+    for (; i + 4 <= Count; i += 4) {
+        __m128i Samples = _mm_loadu_si128(reinterpret_cast<const __m128i *>(Src + i));
+        _mm_storeu_ps(Dst + i, _mm_mul_ps(_mm_cvtepi32_ps(Samples), Scale));
+    }
+    for (; i < Count; i++)
+        ConvertSample(Src[i], Dst[i]);
+}
+#endif
+
+template<typename T>
+void Interleave(const T *const *Src, T *Dst, int Channels, size_t Count) {
+    size_t i = 0;
+#ifdef FFMS_SSE2
+    if (Channels == 2 && sizeof(T) == 4) {
+        const float *L = reinterpret_cast<const float *>(Src[0]);
+        const float *R = reinterpret_cast<const float *>(Src[1]);
+        float *D = reinterpret_cast<float *>(Dst);
+        for (; i + 4 <= Count; i += 4) {
+            __m128 A = _mm_loadu_ps(L + i);
+            __m128 B = _mm_loadu_ps(R + i);
+            _mm_storeu_ps(D + i * 2, _mm_unpacklo_ps(A, B));
+            _mm_storeu_ps(D + i * 2 + 4, _mm_unpackhi_ps(A, B));
+        }
+    } else if (Channels == 2 && sizeof(T) == 2) {
+        const __m128i *L = reinterpret_cast<const __m128i *>(Src[0]);
+        const __m128i *R = reinterpret_cast<const __m128i *>(Src[1]);
+        __m128i *D = reinterpret_cast<__m128i *>(Dst);
+        for (; i + 8 <= Count; i += 8) {
+            __m128i A = _mm_loadu_si128(L + i / 8);
+            __m128i B = _mm_loadu_si128(R + i / 8);
+            _mm_storeu_si128(D + i / 4, _mm_unpacklo_epi16(A, B));
+            _mm_storeu_si128(D + i / 4 + 1, _mm_unpackhi_epi16(A, B));
+        }
+    }
+#endif
+    for (int c = 0; c < Channels; c++) {
+        const T *S = Src[c];
+        for (size_t j = i; j < Count; j++)
+            Dst[j * Channels + c] = S[j];
+    }
+}
+
+template<typename T>
+void Deinterleave(const T *Src, T *const *Dst, int Channels, size_t Count) {
+    size_t i = 0;
+#ifdef FFMS_SSE2
+    if (Channels == 2 && sizeof(T) == 4) {
+        const float *S = reinterpret_cast<const float *>(Src);
+        float *L = reinterpret_cast<float *>(Dst[0]);
+        float *R = reinterpret_cast<float *>(Dst[1]);
+        for (; i + 4 <= Count; i += 4) {
+            __m128 A = _mm_loadu_ps(S + i * 2);
+            __m128 B = _mm_loadu_ps(S + i * 2 + 4);
+            _mm_storeu_ps(L + i, _mm_shuffle_ps(A, B, _MM_SHUFFLE(2, 0, 2, 0)));
+            _mm_storeu_ps(R + i, _mm_shuffle_ps(A, B, _MM_SHUFFLE(3, 1, 3, 1)));
+        }
+    }
+#endif
+    for (int c = 0; c < Channels; c++) {
+        T *D = Dst[c];
+        for (size_t j = i; j < Count; j++)
+            D[j] = Src[j * Channels + c];
+    }
+}
+
+// Layout changes combined with a sample type change are done in chunks which
+// are converted with ConvertRun and then (de)interleaved, so that the
+// conversion itself can still be vectorized
+const size_t ChunkSize = 256;
+
+template<typename In, typename Out, bool InPlanar, bool OutPlanar>
+void Convert(const uint8_t *const *Src, uint8_t *const *Dst, int Channels, int Count) {
+    const In *const *S = reinterpret_cast<const In *const *>(Src);
+    Out *const *D = reinterpret_cast<Out *const *>(Dst);
+
+    if (InPlanar == OutPlanar || Channels == 1) {
+        if (InPlanar && OutPlanar) {
+            for (int c = 0; c < Channels; c++)
+                ConvertRun(S[c], D[c], Count);
+        } else {
+            ConvertRun(S[0], D[0], static_cast<size_t>(Count) * Channels);
+        }
+    } else if (InPlanar) {
+        // planar to packed
+        Out Tmp[ChunkSize];
+        for (size_t Offset = 0; Offset < static_cast<size_t>(Count); Offset += ChunkSize) {
+            size_t n = std::min(ChunkSize, Count - Offset);
+            Out *Dst0 = D[0] + Offset * Channels;
+            for (int c = 0; c < Channels; c++) {
+                ConvertRun(S[c] + Offset, Tmp, n);
+                for (size_t i = 0; i < n; i++)
+                    Dst0[i * Channels + c] = Tmp[i];
+            }
+        }
+    } else {
+        // packed to planar
+        In Tmp[ChunkSize];
+        for (size_t Offset = 0; Offset < static_cast<size_t>(Count); Offset += ChunkSize) {
+            size_t n = std::min(ChunkSize, Count - Offset);
+            const In *Src0 = S[0] + Offset * Channels;
+            for (int c = 0; c < Channels; c++) {
+                for (size_t i = 0; i < n; i++)
+                    Tmp[i] = Src0[i * Channels + c];
+                ConvertRun(Tmp, D[c] + Offset, n);
+            }
+        }
+    }
+}
+
+template<typename T, bool InPlanar, bool OutPlanar>
+void Relayout(const uint8_t *const *Src, uint8_t *const *Dst, int Channels, int Count) {
+    if (InPlanar == OutPlanar || Channels == 1)
+        Convert<T, T, InPlanar, OutPlanar>(Src, Dst, Channels, Count);
+    else if (InPlanar)
+        Interleave(reinterpret_cast<const T *const *>(Src), reinterpret_cast<T *>(Dst[0]), Channels, Count);
+    else
+        Deinterleave(reinterpret_cast<const T *>(Src[0]), reinterpret_cast<T *const *>(Dst), Channels, Count);
+}
+
+template<typename In, typename Out>
+SampleConverter Select(bool InPlanar, bool OutPlanar) {
+    if (InPlanar)
+        return OutPlanar ? Convert<In, Out, true, true> : Convert<In, Out, true, false>;
+    return OutPlanar ? Convert<In, Out, false, true> : Convert<In, Out, false, false>;
+}
+
+template<typename T>
+SampleConverter SelectRelayout(bool InPlanar, bool OutPlanar) {
+    if (InPlanar)
+        return OutPlanar ? Relayout<T, true, true> : Relayout<T, true, false>;
+    return OutPlanar ? Relayout<T, false, true> : Relayout<T, false, false>;
+}
+
+}
+
+SampleConverter GetSampleConverter(AVSampleFormat In, AVSampleFormat Out) {
+    const bool InPlanar = !!av_sample_fmt_is_planar(In);
+    const bool OutPlanar = !!av_sample_fmt_is_planar(Out);
+    const AVSampleFormat InPacked = av_get_packed_sample_fmt(In);
+    const AVSampleFormat OutPacked = av_get_packed_sample_fmt(Out);
+
+    if (InPacked == OutPacked) {
+        switch (InPacked) {
+        case AV_SAMPLE_FMT_U8: return SelectRelayout<uint8_t>(InPlanar, OutPlanar);
+        case AV_SAMPLE_FMT_S16: return SelectRelayout<int16_t>(InPlanar, OutPlanar);
+        case AV_SAMPLE_FMT_S32: return SelectRelayout<int32_t>(InPlanar, OutPlanar);
+        case AV_SAMPLE_FMT_FLT: return SelectRelayout<float>(InPlanar, OutPlanar);
+        case AV_SAMPLE_FMT_DBL: return SelectRelayout<double>(InPlanar, OutPlanar);
+        default: return nullptr;
+        }
+    }
+
+#define CONVERTER(InFmt, InType, OutFmt, OutType) \
+    if (InPacked == InFmt && OutPacked == OutFmt) \
+        return Select<InType, OutType>(InPlanar, OutPlanar);
+
+    CONVERTER(AV_SAMPLE_FMT_S16, int16_t, AV_SAMPLE_FMT_S32, int32_t)
+    CONVERTER(AV_SAMPLE_FMT_S16, int16_t, AV_SAMPLE_FMT_FLT, float)
+    CONVERTER(AV_SAMPLE_FMT_S32, int32_t, AV_SAMPLE_FMT_S16, int16_t)
+    CONVERTER(AV_SAMPLE_FMT_S32, int32_t, AV_SAMPLE_FMT_FLT, float)
+    CONVERTER(AV_SAMPLE_FMT_FLT, float, AV_SAMPLE_FMT_S16, int16_t)
+    CONVERTER(AV_SAMPLE_FMT_FLT, float, AV_SAMPLE_FMT_S32, int32_t)
+#undef CONVERTER
+
+    return nullptr;
+}
@@ -0,0 +1,39 @@
+//  Copyright (c) 2026 The FFmpegSource Project
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#ifndef AUDIOCONVERT_H
+#define AUDIOCONVERT_H
+
+extern "C" {
+#include <libavutil/samplefmt.h>
+}
+
+#include <cstdint>
+
+// Converts Count samples with Channels channels. Src and Dst hold one
+// pointer per channel for planar formats and a single one for packed ones.
+typedef void (*SampleConverter)(const uint8_t *const *Src, uint8_t *const *Dst, int Channels, int Count);
+
+// Returns a converter for changes of only the sample format and/or planar
+// layout, or nullptr if the conversion has to go through swresample. The
+// results match swresample's conversions without dithering.
+SampleConverter GetSampleConverter(AVSampleFormat In, AVSampleFormat Out);
+
+#endif
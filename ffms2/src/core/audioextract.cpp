@@ -0,0 +1,241 @@
+//  Copyright (c) 2026 The FFmpegSource Project
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "audioextract.h"
+
+#include "audioconvert.h"
+#include "indexing.h"
+#include "track.h"
+#include "utils.h"
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+}
+
+#include <memory>
+
+namespace {
+
+struct ExtractTrack {
+    int Track;
+    FFMS_Track Frames;
+    AVCodecContext *CodecContext = nullptr;
+    FFMS_AudioProperties AP = {};
+    // Next packet in the index, which the next decoded samples belong to
+    size_t PacketNumber = 0;
+    SampleConverter Converter = nullptr;
+    std::vector<uint8_t> Buffer;
+    // Samples decoded from the current packet so far
+    int64_t PacketSamples = 0;
+
+    ~ExtractTrack() {
+        avcodec_free_context(&CodecContext);
+    }
+};
+
+class AudioExtractor {
+    AVFormatContext *FormatContext = nullptr;
+    AVFrame *DecodeFrame = nullptr;
+    std::vector<std::unique_ptr<ExtractTrack>> Tracks;
+    std::vector<ExtractTrack *> TrackMap;
+    TAudioSinkCallback Sink;
+    void *SinkPrivate;
+
+    void OpenTrack(ExtractTrack &T);
+    void ReceiveFrames(ExtractTrack &T);
+    void Deliver(ExtractTrack &T, const uint8_t *Data, int64_t Count);
+    void FinishPacket(ExtractTrack &T);
+
+public:
+    AudioExtractor(const char *SourceFile, FFMS_Index &Index, std::vector<int> const& TrackNumbers, TAudioSinkCallback Sink, void *SinkPrivate);
+    ~AudioExtractor();
+    void Run();
+};
+
+AudioExtractor::AudioExtractor(const char *SourceFile, FFMS_Index &Index, std::vector<int> const& TrackNumbers, TAudioSinkCallback Sink, void *SinkPrivate)
+    : Sink(Sink), SinkPrivate(SinkPrivate) {
+    if (!Index.CompareFileSignature(SourceFile))
+        throw FFMS_Exception(FFMS_ERROR_INDEX, FFMS_ERROR_FILE_MISMATCH,
+            "The index does not match the source file");
+
+    for (int Track : TrackNumbers) {
+        if (Track < 0 || Track >= static_cast<int>(Index.size()) || Index[Track].TT != FFMS_TYPE_AUDIO)
+            throw FFMS_Exception(FFMS_ERROR_INDEX, FFMS_ERROR_INVALID_ARGUMENT,
+                "Not an audio track");
+        Tracks.emplace_back(new ExtractTrack);
+        Tracks.back()->Track = Track;
+        Tracks.back()->Frames = Index[Track];
+    }
+
+    try {
+        // Only the selected streams are demuxed
+        LAVFOpenFile(SourceFile, FormatContext, -1);
+        TrackMap.resize(FormatContext->nb_streams);
+        for (auto &T : Tracks) {
+            if (T->Track >= static_cast<int>(FormatContext->nb_streams))
+                throw FFMS_Exception(FFMS_ERROR_INDEX, FFMS_ERROR_FILE_MISMATCH,
+                    "The index does not match the source file");
+            FormatContext->streams[T->Track]->discard = AVDISCARD_DEFAULT;
+            TrackMap[T->Track] = T.get();
+            OpenTrack(*T);
+        }
+
+        DecodeFrame = av_frame_alloc();
+        if (!DecodeFrame)
+            throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_ALLOCATION_FAILED,
+                "Couldn't allocate frame");
+    } catch (...) {
+        av_frame_free(&DecodeFrame);
+        avformat_close_input(&FormatContext);
+        throw;
+    }
+}
+
+AudioExtractor::~AudioExtractor() {
+    Tracks.clear();
+    av_frame_free(&DecodeFrame);
+    avformat_close_input(&FormatContext);
+}
+
+void AudioExtractor::OpenTrack(ExtractTrack &T) {
+    AVCodec *Codec = avcodec_find_decoder(FormatContext->streams[T.Track]->codecpar->codec_id);
+    if (Codec == nullptr)
+        throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_CODEC,
+            "Audio codec not found");
+
+    T.CodecContext = avcodec_alloc_context3(Codec);
+    if (T.CodecContext == nullptr)
+        throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_ALLOCATION_FAILED,
+            "Could not allocate audio decoding context");
+
+    if (avcodec_parameters_to_context(T.CodecContext, FormatContext->streams[T.Track]->codecpar) < 0)
+        throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_CODEC,
+            "Could not copy audio codec parameters");
+
+    if (avcodec_open2(T.CodecContext, Codec, nullptr) < 0)
+        throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_CODEC,
+            "Could not open audio codec");
+}
+
+void AudioExtractor::Deliver(ExtractTrack &T, const uint8_t *Data, int64_t Count) {
+    if (Count <= 0)
+        return;
+    int64_t Start = T.Frames[T.PacketNumber].SampleStart + T.PacketSamples;
+    T.PacketSamples += Count;
+    if (Sink(T.Track, &T.AP, Data, Start, Count, SinkPrivate))
+        throw FFMS_Exception(FFMS_ERROR_CANCELLED, FFMS_ERROR_USER,
+            "Cancelled by user");
+}
+
+void AudioExtractor::ReceiveFrames(ExtractTrack &T) {
+    while (T.PacketNumber < T.Frames.size()) {
+        av_frame_unref(DecodeFrame);
+        if (avcodec_receive_frame(T.CodecContext, DecodeFrame) != 0 || DecodeFrame->nb_samples <= 0)
+            break;
+
+        if (!T.AP.SampleRate) {
+            FillAP(T.AP, T.CodecContext, T.Frames);
+            const AVSampleFormat Format = static_cast<AVSampleFormat>(DecodeFrame->format);
+            if (av_sample_fmt_is_planar(Format)) {
+                T.Converter = GetSampleConverter(Format, av_get_packed_sample_fmt(Format));
+                if (!T.Converter)
+                    throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_UNSUPPORTED,
+                        "Unsupported audio sample format");
+            }
+        }
+
+        const uint8_t *Data = DecodeFrame->extended_data[0];
+        if (T.Converter) {
+            T.Buffer.resize(static_cast<size_t>(DecodeFrame->nb_samples) * T.AP.Channels * (T.AP.BitsPerSample / 8));
+            uint8_t *Dst = T.Buffer.data();
+            T.Converter(DecodeFrame->extended_data, &Dst, T.AP.Channels, DecodeFrame->nb_samples);
+            Data = Dst;
+        }
+        Deliver(T, Data, DecodeFrame->nb_samples);
+    }
+}
+
+// Pads the packet to the length in the index, like audio sources do, and
+// moves on to the next one
+void AudioExtractor::FinishPacket(ExtractTrack &T) {
+    // Zero sample packets aren't included in the index
+    if (!T.PacketSamples || T.PacketNumber >= T.Frames.size())
+        return;
+
+    const int64_t Missing = T.Frames[T.PacketNumber].SampleCount - T.PacketSamples;
+    if (Missing > 0) {
+        T.Buffer.assign(static_cast<size_t>(Missing) * T.AP.Channels * (T.AP.BitsPerSample / 8),
+            T.AP.SampleFormat == FFMS_FMT_U8 ? 0x80 : 0);
+        Deliver(T, T.Buffer.data(), Missing);
+    }
+    ++T.PacketNumber;
+    T.PacketSamples = 0;
+}
+
+void AudioExtractor::Run() {
+    AVPacket Packet;
+    InitNullPacket(Packet);
+    while (av_read_frame(FormatContext, &Packet) >= 0) {
+        ExtractTrack *T = Packet.stream_index < static_cast<int>(TrackMap.size()) ? TrackMap[Packet.stream_index] : nullptr;
+        if (T && T->PacketNumber < T->Frames.size()) {
+            int Ret = avcodec_send_packet(T->CodecContext, &Packet);
+            av_packet_unref(&Packet);
+            if (Ret == 0) {
+                ReceiveFrames(*T);
+                FinishPacket(*T);
+            }
+        } else {
+            av_packet_unref(&Packet);
+        }
+    }
+
+    // Drain whatever the decoders are still holding on to
+    for (auto &T : Tracks) {
+        avcodec_send_packet(T->CodecContext, nullptr);
+        while (T->PacketNumber < T->Frames.size()) {
+            ReceiveFrames(*T);
+            if (!T->PacketSamples)
+                break;
+            FinishPacket(*T);
+        }
+    }
+}
+
+}
+
+void ExtractAudioTracks(const char *SourceFile, FFMS_Index &Index, std::vector<int> Tracks, TAudioSinkCallback Sink, void *SinkPrivate) {
+    if (!Sink)
+        throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_INVALID_ARGUMENT,
+            "No audio sink given");
+
+    if (Tracks.empty()) {
+        for (size_t i = 0; i < Index.size(); i++) {
+            if (Index[i].TT == FFMS_TYPE_AUDIO && !Index[i].empty())
+                Tracks.push_back(static_cast<int>(i));
+        }
+        if (Tracks.empty())
+            throw FFMS_Exception(FFMS_ERROR_INDEX, FFMS_ERROR_NOT_AVAILABLE,
+                "No indexed audio tracks");
+    }
+
+    AudioExtractor Extractor(SourceFile, Index, Tracks, Sink, SinkPrivate);
+    Extractor.Run();
+}
@@ -0,0 +1,35 @@
+//  Copyright (c) 2026 The FFmpegSource Project
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#ifndef AUDIOEXTRACT_H
+#define AUDIOEXTRACT_H
+
+#include "ffms.h"
+
+#include <vector>
+
+struct FFMS_Index;
+
+// Decodes the given audio tracks from start to end in a single pass over the
+// file, handing each decoded packet to Sink in the track's packed sample
+// format. Empty Tracks selects every indexed audio track.
+void ExtractAudioTracks(const char *SourceFile, FFMS_Index &Index, std::vector<int> Tracks, TAudioSinkCallback Sink, void *SinkPrivate);
+
+#endif
@@ -21,9 +21,16 @@
 #include "audiosource.h"
 
 #include "indexing.h"
+#include "spectrogram.h"
 
 #include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <exception>
+#include <numeric>
+#include <system_error>
+#include <tuple>
 
 extern "C" {
 #include <libavutil/channel_layout.h>
@@ -73,6 +80,9 @@ FFMS_AudioSource::FFMS_AudioSource(const char *SourceFile, FFMS_Index &Index, in
                 "The index does not match the source file");
 
         Frames = Index[Track];
+        SourceFilesize = Index.Filesize;
+        memcpy(SourceDigest, Index.Digest, sizeof(SourceDigest));
+        OpenPCM();
 
         DecodeFrame = av_frame_alloc();
         if (!DecodeFrame)
@@ -92,6 +102,94 @@ FFMS_AudioSource::FFMS_AudioSource(const char *SourceFile, FFMS_Index &Index, in
     }
 }
 
+FFMS_AudioSource::FFMS_AudioSource(const FFMS_AudioSource &Source)
+    : LastValidTS(AV_NOPTS_VALUE), SourceFile(Source.SourceFile), ResampleContext{ swr_alloc() }, TrackNumber(Source.TrackNumber) {
+    try {
+        Frames = Source.Frames;
+        SeekOffset = Source.SeekOffset;
+
+        DecodeFrame = av_frame_alloc();
+        if (!DecodeFrame)
+            throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_ALLOCATION_FAILED,
+                "Couldn't allocate frame");
+        OpenFile();
+
+        // The codec context has to see a packet before the sample format is
+        // known, but everything else is the same as in the source
+        for (size_t i = 0; i < Frames.size(); i++) {
+            if (DecodeNextBlock())
+                break;
+        }
+
+        AP = Source.AP;
+        SourceSampleRate = Source.SourceSampleRate;
+        SourceSamples = Source.SourceSamples;
+        SourceDelay = Source.SourceDelay;
+        SourceStart = Source.SourceStart;
+        CacheBudget = Source.CacheBudget;
+        SetOutputFormat(Source.OutputOptions);
+    } catch (...) {
+        Free();
+        throw;
+    }
+}
+
+namespace {
+    // Number of freed buffers kept for reuse
+    const size_t MaxFreeBlocks = 8;
+}
+
+AudioBlockAllocator::~AudioBlockAllocator() {
+    Trim();
+}
+
+AudioBlockAllocator::Pointer AudioBlockAllocator::Allocate(size_t Size) {
+    uint8_t *ptr = nullptr;
+    for (auto it = FreeBuffers.rbegin(); it != FreeBuffers.rend(); ++it) {
+        if (it->first == Size) {
+            ptr = it->second;
+            FreeBuffers.erase(std::next(it).base());
+            Free -= Size;
+            break;
+        }
+    }
+    if (!ptr) {
+        ptr = static_cast<uint8_t *>(malloc(Size ? Size : 1));
+        if (!ptr)
+            throw std::bad_alloc();
+        Held += Size;
+    }
+
+    Release Deleter;
+    Deleter.Owner = this;
+    Deleter.Size = Size;
+    return Pointer(ptr, Deleter);
+}
+
+void AudioBlockAllocator::Recycle(uint8_t *ptr, size_t Size) {
+    if (!ptr)
+        return;
+    if (FreeBuffers.size() >= MaxFreeBlocks) {
+        free(FreeBuffers.front().second);
+        Held -= FreeBuffers.front().first;
+        Free -= FreeBuffers.front().first;
+        FreeBuffers.erase(FreeBuffers.begin());
+    }
+    FreeBuffers.emplace_back(Size, ptr);
+    Free += Size;
+}
+
+void AudioBlockAllocator::Trim() {
+    for (auto &Buffer : FreeBuffers) {
+        free(Buffer.second);
+        Held -= Buffer.first;
+    }
+    FreeBuffers.clear();
+    Free = 0;
+}
+
+std::atomic<size_t> FFMS_AudioSource::GlobalCacheBytes{ 0 };
+std::atomic<size_t> FFMS_AudioSource::GlobalCacheLimit{ 0 };
 
 #define EXCESSIVE_CACHE_SIZE 400
 
@@ -111,6 +209,9 @@ void FFMS_AudioSource::Init(const FFMS_Index &Index, int DelayMode) {
         throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_CODEC,
             "Codec returned zero size audio");
 
+    SourceSampleRate = AP.SampleRate;
+    SourceSamples = AP.NumSamples;
+
     auto opt = CreateResampleOptions();
     SetOutputFormat(*opt);
 
@@ -118,6 +219,14 @@ void FFMS_AudioSource::Init(const FFMS_Index &Index, int DelayMode) {
         throw FFMS_Exception(FFMS_ERROR_INDEX, FFMS_ERROR_INVALID_ARGUMENT,
             "Bad audio delay compensation mode");
 
+    if (Frames.HasTS) {
+        int i = 0;
+        while (Frames[i].PTS == AV_NOPTS_VALUE) ++i;
+        SourceStart = Frames[i].PTS * Frames.TB.Num * SourceSampleRate / (Frames.TB.Den * 1000);
+        for (; i > 0; --i)
+            SourceStart -= Frames[i].SampleCount;
+    }
+
     if (DelayMode == FFMS_DELAY_NO_SHIFT) return;
 
     if (DelayMode > (signed)Index.size())
@@ -139,18 +248,39 @@ void FFMS_AudioSource::Init(const FFMS_Index &Index, int DelayMode) {
 
     if (DelayMode >= 0) {
         const FFMS_Track &VTrack = Index[DelayMode];
-        Delay = -(VTrack[0].PTS * VTrack.TB.Num * AP.SampleRate / (VTrack.TB.Den * 1000));
+        SourceDelay = -(VTrack[0].PTS * VTrack.TB.Num * SourceSampleRate / (VTrack.TB.Den * 1000));
     }
 
-    if (Frames.HasTS) {
-        int i = 0;
-        while (Frames[i].PTS == AV_NOPTS_VALUE) ++i;
-        Delay += Frames[i].PTS * Frames.TB.Num * AP.SampleRate / (Frames.TB.Den * 1000);
-        for (; i > 0; --i)
-            Delay -= Frames[i].SampleCount;
+    SourceDelay += SourceStart;
+
+    UpdateSampleCounts();
+}
+
+void FFMS_AudioSource::OpenPCM() {
+    int64_t Offset;
+    int BlockAlign;
+    if (!Frames.GetPCMLayout(Offset, BlockAlign))
+        return;
+
+    // Mapping can fail for reasons such as running out of address space, in
+    // which case the track is simply decoded like any other
+    try {
+        PCMFile = make_unique<MappedFile>(SourceFile.c_str(), FFMS_ERROR_DECODING);
+    } catch (FFMS_Exception &) {
+        return;
     }
 
-    AP.NumSamples += Delay;
+    const uint64_t End = static_cast<uint64_t>(Offset) + (Frames.back().SampleStart + Frames.back().SampleCount) * BlockAlign;
+    if (End > PCMFile->GetSize()) {
+        PCMFile.reset();
+        return;
+    }
+    PCMData = PCMFile->GetData() + Offset;
+}
+
+void FFMS_AudioSource::UpdateSampleCounts() {
+    Delay = SourceDelay * RateOut / RateIn;
+    AP.NumSamples = SourceSamples * RateOut / RateIn + Delay;
 }
 
 void FFMS_AudioSource::CacheBeginning() {
@@ -169,61 +299,121 @@ void FFMS_AudioSource::CacheBeginning() {
     // file (ts and?), so cache a few blocks even if PTSes are unique
     // Packet 7 is the last packet I've had be unseekable to, so cache up to
     // 10 for a bit of an extra buffer
-    auto end = Cache.end();
-    while (PacketNumber < Frames.size() &&
-        ((Frames[0].PTS != AV_NOPTS_VALUE && Frames[PacketNumber].PTS == Frames[0].PTS) ||
-            Cache.size() < 10)) {
-
-        // Vorbis in particular seems to like having 60+ packets at the start
-        // of the file with a PTS of 0, so we might need to expand the search
-        // range to account for that.
-        // Expanding slightly before it's strictly needed to ensure there's a
-        // bit of space for an actual cache
-        if (Cache.size() >= MaxCacheBlocks - 5) {
-            if (MaxCacheBlocks >= EXCESSIVE_CACHE_SIZE)
+    // These blocks are needed for correctness rather than speed, so they're
+    // kept out of the LRU list and never evicted
+    CachePermanent = true;
+    try {
+        while (PacketNumber < Frames.size() &&
+            ((Frames[0].PTS != AV_NOPTS_VALUE && Frames[PacketNumber].PTS == Frames[0].PTS) ||
+                Cache.size() < 10)) {
+
+            // Vorbis in particular seems to like having 60+ packets at the start
+            // of the file with a PTS of 0, so we might need to search quite far
+            if (Cache.size() >= EXCESSIVE_CACHE_SIZE)
                 throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_ALLOCATION_FAILED,
                     "Exceeded the search range for an initial valid audio PTS");
-            MaxCacheBlocks *= 2;
-        }
 
-        DecodeNextBlock(&end);
+            DecodeNextBlock(true);
+        }
+    } catch (...) {
+        CachePermanent = false;
+        throw;
     }
-    // Store the iterator to the last element of the cache which is used for
-    // correctness rather than speed, so that when looking for one to delete
-    // we know how much to skip
-    CacheNoDelete = Cache.end();
-    --CacheNoDelete;
+    CachePermanent = false;
+    PermanentPackets = PacketNumber;
 }
 
-void FFMS_AudioSource::SetOutputFormat(FFMS_ResampleOptions const& opt) {
-    if (opt.SampleRate != AP.SampleRate)
-        throw FFMS_Exception(FFMS_ERROR_RESAMPLING, FFMS_ERROR_UNSUPPORTED,
-            "Sample rate changes are currently unsupported.");
+bool FFMS_AudioSource::SeeksIntoBeginning(int64_t Start) const {
+    Start -= Delay;
+    if (Start <= 0)
+        return true;
+    return Frames.FindAudioSeekPoint(DecodeStart(Start)).SeekPacket < PermanentPackets;
+}
 
-    // Cache stores audio in the output format, so clear it and reopen the file
-    Cache.clear();
+int64_t FFMS_AudioSource::DecodeStart(int64_t Start) const {
+    // With rate conversion Start is an output sample, so decoding has to
+    // begin far enough before it for the resampler to be aligned and warmed up
+    if (RateConversion)
+        return FFMAX(Start * RateIn / RateOut - WarmupSamples - 2 * RateIn - 1, 0);
+    return Start;
+}
+
+void FFMS_AudioSource::SetOutputFormat(FFMS_ResampleOptions const& opt) {
+    std::lock_guard<std::mutex> Guard(SourceMutex);
+
+    if (opt.SampleRate <= 0)
+        throw FFMS_Exception(FFMS_ERROR_RESAMPLING, FFMS_ERROR_INVALID_ARGUMENT,
+            "Invalid output sample rate");
+
+    if (!PinnedBlocks.empty() || SidecarSpans)
+        throw FFMS_Exception(FFMS_ERROR_RESAMPLING, FFMS_ERROR_USER,
+            "Audio spans must be released before changing the output format");
+
+    if (opt.SampleFormat < FFMS_FMT_U8 || opt.SampleFormat > FFMS_FMT_DBLP)
+        throw FFMS_Exception(FFMS_ERROR_RESAMPLING, FFMS_ERROR_INVALID_ARGUMENT,
+            "Invalid output sample format");
+
+    // Cache and sidecar store audio in the output format, so clear them and
+    // reopen the file
+    ClearCache();
+    Sidecar.reset();
+    SidecarData = nullptr;
+    LastReadEnd = -1;
+    PrefetchFailedAt = -1;
     PacketNumber = 0;
     OpenFile();
     avcodec_flush_buffers(CodecContext);
+    OutputOptions = opt;
+
+    const AVSampleFormat OutputFormat = static_cast<AVSampleFormat>(opt.SampleFormat);
+    OutputChannels = av_get_channel_layout_nb_channels(opt.ChannelLayout);
+    OutputPlanes = av_sample_fmt_is_planar(OutputFormat) ? OutputChannels : 1;
+    OutputPointers.resize(OutputPlanes);
+    BytesPerSample = av_get_bytes_per_sample(OutputFormat) * OutputChannels;
+
+    int64_t RateGCD = std::gcd(SourceSampleRate, opt.SampleRate);
+    RateIn = SourceSampleRate / RateGCD;
+    RateOut = opt.SampleRate / RateGCD;
+    RateConversion = RateIn != RateOut;
+    AP.SampleRate = opt.SampleRate;
+    UpdateSampleCounts();
+
+    ResampleNext = -1;
+    ResampleOutput = 0;
+    WarmupEnd = 0;
+    if (RateConversion) {
+        // The filter reaches further back when downsampling as the cutoff
+        // frequency is lowered, and a bit of margin doesn't hurt
+        const int64_t FilterSize = FFMAX(opt.ResampleFilterSize, 1);
+        WarmupSamples = 2 * FilterSize * FFMAX(1, (RateIn + RateOut - 1) / RateOut) + 64;
+        WarmupOutput = (WarmupSamples * RateOut + RateIn - 1) / RateIn;
+    }
 
-    BytesPerSample = av_get_bytes_per_sample(static_cast<AVSampleFormat>(opt.SampleFormat)) * av_get_channel_layout_nb_channels(opt.ChannelLayout);
+    Converter = nullptr;
+    // The converters only do plain conversions, so dithering a change of
+    // sample format is left to swresample
     NeedsResample =
-        opt.SampleFormat != (int)CodecContext->sample_fmt ||
-        opt.SampleRate != AP.SampleRate ||
+        RateConversion ||
         opt.ChannelLayout != AP.ChannelLayout ||
-        opt.ForceResample;
+        opt.ForceResample ||
+        (opt.DitherMethod != FFMS_RESAMPLE_DITHER_NONE && OutputFormat != CodecContext->sample_fmt);
+    if (!NeedsResample) {
+        Converter = GetSampleConverter(CodecContext->sample_fmt, OutputFormat);
+        NeedsResample = !Converter;
+    }
+    DirectPCM = PCMData && !NeedsResample && OutputFormat == CodecContext->sample_fmt;
 
     if (!NeedsResample) return;
 
     FFResampleContext newContext{ swr_alloc() };
     SetOptions(opt, newContext.get(), resample_options);
-    av_opt_set_int(newContext.get(), "in_sample_rate", AP.SampleRate, 0);
+    av_opt_set_int(newContext.get(), "in_sample_rate", SourceSampleRate, 0);
     av_opt_set_int(newContext.get(), "in_sample_fmt", CodecContext->sample_fmt, 0);
     av_opt_set_int(newContext.get(), "in_channel_layout", AP.ChannelLayout, 0);
 
     av_opt_set_int(newContext.get(), "out_sample_rate", opt.SampleRate, 0);
     av_opt_set_channel_layout(newContext.get(), "out_channel_layout", opt.ChannelLayout, 0);
-    av_opt_set_sample_fmt(newContext.get(), "out_sample_fmt", (AVSampleFormat)opt.SampleFormat, 0);
+    av_opt_set_sample_fmt(newContext.get(), "out_sample_fmt", OutputFormat, 0);
 
     if (swr_init(newContext.get()))
         throw FFMS_Exception(FFMS_ERROR_RESAMPLING, FFMS_ERROR_UNKNOWN,
@@ -231,6 +421,105 @@ void FFMS_AudioSource::SetOutputFormat(FFMS_ResampleOptions const& opt) {
     newContext.swap(ResampleContext);
 }
 
+void FFMS_AudioSource::ResampleFrame() {
+    int64_t FrameStart = CurrentSample;
+    int64_t Skip = 0;
+
+    // The input isn't contiguous with what the resampler was last fed, so
+    // restart it at the next aligned source sample. Outputs until the
+    // filter has warmed up differ from those of an uninterrupted pass and
+    // aren't cached, except at the start of the file where there's nothing
+    // before anyway.
+    if (FrameStart != ResampleNext) {
+        int64_t Aligned = (FrameStart + RateIn - 1) / RateIn * RateIn;
+        Skip = Aligned - FrameStart;
+        ResampleNext = -1;
+        if (Skip >= DecodeFrame->nb_samples)
+            return;
+
+        swr_close(ResampleContext.get());
+        if (swr_init(ResampleContext.get()))
+            throw FFMS_Exception(FFMS_ERROR_RESAMPLING, FFMS_ERROR_UNKNOWN,
+                "Could not reinitialize the resampler");
+        ResampleNext = Aligned;
+        ResampleOutput = Aligned / RateIn * RateOut;
+        WarmupEnd = Aligned ? ResampleOutput + WarmupOutput : 0;
+    }
+
+    const AVSampleFormat InputFormat = static_cast<AVSampleFormat>(DecodeFrame->format);
+    const bool InputPlanar = !!av_sample_fmt_is_planar(InputFormat);
+    const size_t InputSampleSize = av_get_bytes_per_sample(InputFormat) * (InputPlanar ? 1 : DecodeFrame->channels);
+    InputPointers.resize(InputPlanar ? DecodeFrame->channels : 1);
+    for (size_t p = 0; p < InputPointers.size(); p++)
+        InputPointers[p] = DecodeFrame->extended_data[p] + Skip * InputSampleSize;
+
+    const int InputCount = DecodeFrame->nb_samples - static_cast<int>(Skip);
+    const int MaxOutput = swr_get_out_samples(ResampleContext.get(), InputCount);
+    const size_t PlaneSize = static_cast<size_t>(FFMAX(MaxOutput, 0)) * (BytesPerSample / OutputPlanes);
+    if (ResampleBuffer.size() < PlaneSize * OutputPlanes)
+        ResampleBuffer.resize(PlaneSize * OutputPlanes);
+    for (int p = 0; p < OutputPlanes; p++)
+        OutputPointers[p] = ResampleBuffer.data() + p * PlaneSize;
+
+    int Count = swr_convert(ResampleContext.get(), OutputPointers.data(), MaxOutput, InputPointers.data(), InputCount);
+    if (Count < 0)
+        throw FFMS_Exception(FFMS_ERROR_RESAMPLING, FFMS_ERROR_UNKNOWN,
+            "Resampling failed");
+    ResampleNext += InputCount;
+    CacheResampled(Count);
+}
+
+void FFMS_AudioSource::CacheResampled(int64_t Count) {
+    int64_t Pos = ResampleOutput;
+    ResampleOutput += Count;
+
+    int64_t Skip = FFMAX(WarmupEnd - Pos, 0);
+    if (Skip >= Count)
+        return;
+    Pos += Skip;
+    Count -= Skip;
+
+    // Blocks are identical no matter which pass produced them, so there's
+    // no reason to replace an existing one
+    if (Cache.count(Pos))
+        return;
+
+    const size_t SampleSize = BytesPerSample / OutputPlanes;
+    AudioBlock *block = NewBlock(Pos, Count);
+    for (int p = 0; p < OutputPlanes; p++)
+        memcpy(block->GetPlane(p, 0), OutputPointers[p] + Skip * SampleSize, Count * SampleSize);
+    block->Samples = Count;
+
+    LastBlock = block;
+    EvictBlocks();
+}
+
+void FFMS_AudioSource::FlushResampler() {
+    if (ResampleNext < 0)
+        return;
+    ResampleNext = -1;
+
+    const size_t SampleSize = BytesPerSample / OutputPlanes;
+    const int MaxOutput = 4096;
+    if (ResampleBuffer.size() < MaxOutput * BytesPerSample)
+        ResampleBuffer.resize(MaxOutput * BytesPerSample);
+    for (int p = 0; p < OutputPlanes; p++)
+        OutputPointers[p] = ResampleBuffer.data() + p * MaxOutput * SampleSize;
+
+    int Count;
+    while ((Count = swr_convert(ResampleContext.get(), OutputPointers.data(), MaxOutput, nullptr, 0)) > 0)
+        CacheResampled(Count);
+
+    // Pad with silence if the resampler came up short of the advertised length
+    int64_t Missing = AP.NumSamples - Delay - ResampleOutput;
+    if (Missing > 0) {
+        ResampleBuffer.assign(static_cast<size_t>(Missing * BytesPerSample), 0);
+        for (int p = 0; p < OutputPlanes; p++)
+            OutputPointers[p] = ResampleBuffer.data() + p * Missing * (BytesPerSample / OutputPlanes);
+        CacheResampled(Missing);
+    }
+}
+
 std::unique_ptr<FFMS_ResampleOptions> FFMS_AudioSource::CreateResampleOptions() const {
     auto ret = ReadOptions(ResampleContext.get(), resample_options);
     ret->SampleRate = AP.SampleRate;
@@ -239,50 +528,173 @@ std::unique_ptr<FFMS_ResampleOptions> FFMS_AudioSource::CreateResampleOptions()
     return ret;
 }
 
-void FFMS_AudioSource::ResampleAndCache(CacheIterator pos) {
-    AudioBlock& block = *pos;
-
-    size_t size = DecodeFrame->nb_samples * BytesPerSample;
-    auto dst = block.Grow(size);
+void FFMS_AudioSource::ResampleAndCache(AudioBlock &block) {
+    ReserveBlock(block, DecodeFrame->nb_samples);
+    for (int p = 0; p < OutputPlanes; p++)
+        OutputPointers[p] = block.GetPlane(p, block.Samples);
 
-    uint8_t *OutPlanes[1] = { dst };
+    if (NeedsResample)
+        swr_convert(ResampleContext.get(), OutputPointers.data(), DecodeFrame->nb_samples, (const uint8_t **)DecodeFrame->extended_data, DecodeFrame->nb_samples);
+    else
+        Converter(DecodeFrame->extended_data, OutputPointers.data(), OutputChannels, DecodeFrame->nb_samples);
 
-    swr_convert(ResampleContext.get(), OutPlanes, DecodeFrame->nb_samples, (const uint8_t **)DecodeFrame->extended_data, DecodeFrame->nb_samples);
+    block.Samples += DecodeFrame->nb_samples;
 }
 
-FFMS_AudioSource::AudioBlock *FFMS_AudioSource::CacheBlock(CacheIterator &pos) {
+FFMS_AudioSource::AudioBlock *FFMS_AudioSource::CacheBlock() {
     // If the previous block has the same Start sample as this one, then
     // we got multiple frames of audio out of a single packet and should
     // combine them
-    auto block = pos;
-    if (pos == Cache.begin() || (--block)->Start != CurrentSample)
-        block = Cache.emplace(pos, CurrentSample);
+    AudioBlock *block = LastBlock;
+    if (!block || block->Start != CurrentSample) {
+        // Already cached by an earlier pass over this part of the file. The
+        // first packets decoded after a seek are often decoded incorrectly,
+        // so keep the existing block rather than replacing it.
+        if (Cache.count(CurrentSample)) {
+            LastBlock = nullptr;
+            return nullptr;
+        }
+        int64_t Capacity = FFMAX(CurrentFrame->SampleCount, static_cast<uint32_t>(DecodeFrame->nb_samples));
+        block = NewBlock(CurrentSample, Capacity);
+        LastBlock = block;
+    }
 
-    block->Samples += DecodeFrame->nb_samples;
+    ResampleAndCache(*block);
 
-    if (NeedsResample)
-        ResampleAndCache(block);
-    else {
-        const uint8_t *data = DecodeFrame->extended_data[0];
-        auto dst = block->Grow(DecodeFrame->nb_samples * BytesPerSample);
-        memcpy(dst, data, DecodeFrame->nb_samples * BytesPerSample);
+    EvictBlocks();
+    return block;
+}
+
+FFMS_AudioSource::AudioBlock *FFMS_AudioSource::NewBlock(int64_t Start, int64_t Capacity) {
+    AudioBlock *block = &Cache.emplace(std::piecewise_construct,
+        std::forward_as_tuple(Start),
+        std::forward_as_tuple(Start, BlockAllocator, Capacity, BytesPerSample / OutputPlanes, OutputPlanes)).first->second;
+    block->Permanent = CachePermanent;
+    if (block->Permanent)
+        PermanentBytes += block->AllocatedSize();
+    UpdateCacheBytes();
+
+    // Past the global limit the cache stops growing rather than pushing out
+    // blocks that are more likely to be read again, and new blocks are only
+    // kept until whatever needed them has had a chance to read them
+    if (!CachePermanent && GlobalCacheLimit && GlobalCacheBytes >= GlobalCacheLimit) {
+        block->Uncached = true;
+        UncachedBlocks.push_back(block);
+    }
+    TouchBlock(block);
+    return block;
+}
+
+FFMS_AudioSource::AudioBlock *FFMS_AudioSource::FindBlock(int64_t Sample) {
+    auto it = Cache.upper_bound(Sample);
+    if (it == Cache.begin())
+        return nullptr;
+    AudioBlock &block = (--it)->second;
+    return block.Start + block.Samples > Sample ? &block : nullptr;
+}
+
+void FFMS_AudioSource::TouchBlock(AudioBlock *Block) {
+    if (Block->Permanent || Block->Uncached || Block->Pins || Block == NewestBlock)
+        return;
+    UnlinkBlock(Block);
+    Block->Older = NewestBlock;
+    if (NewestBlock)
+        NewestBlock->Newer = Block;
+    NewestBlock = Block;
+    if (!OldestBlock)
+        OldestBlock = Block;
+}
+
+void FFMS_AudioSource::UnlinkBlock(AudioBlock *Block) {
+    if (Block->Newer)
+        Block->Newer->Older = Block->Older;
+    else if (NewestBlock == Block)
+        NewestBlock = Block->Older;
+    if (Block->Older)
+        Block->Older->Newer = Block->Newer;
+    else if (OldestBlock == Block)
+        OldestBlock = Block->Newer;
+    Block->Newer = Block->Older = nullptr;
+}
+
+void FFMS_AudioSource::EvictBlocks() {
+    // Permanent blocks don't count towards the budget, while the buffers
+    // kept for reuse do. Evicting a block usually just moves its buffer to
+    // the free list, where the next block picks it up.
+    // Never drop the block currently being decoded into
+    while (CacheBytes - PermanentBytes > CacheBudget) {
+        if (OldestBlock && OldestBlock != LastBlock) {
+            AudioBlock *block = OldestBlock;
+            UnlinkBlock(block);
+            Cache.erase(block->Start);
+        } else if (BlockAllocator.FreeBytes()) {
+            BlockAllocator.Trim();
+        } else {
+            break;
+        }
+        UpdateCacheBytes();
     }
+}
 
-    if (Cache.size() >= MaxCacheBlocks) {
-        // Kill the oldest one
-        auto min = CacheNoDelete;
-        // Never drop the first one as the first packet decoded after a seek
-        // is often decoded incorrectly and we can't seek to before the first one
-        ++min;
-        for (auto it = min; it != Cache.end(); ++it)
-            if (it->Age < min->Age) min = it;
-        if (min == pos) ++pos;
-        Cache.erase(min);
+void FFMS_AudioSource::DropUncachedBlocks() {
+    // Pinned blocks have to stay until their spans are released
+    size_t Kept = 0;
+    for (AudioBlock *Block : UncachedBlocks) {
+        if (Block->Pins) {
+            UncachedBlocks[Kept++] = Block;
+            continue;
+        }
+        if (Block == LastBlock)
+            LastBlock = nullptr;
+        Cache.erase(Block->Start);
     }
-    return &*block;
+    UncachedBlocks.resize(Kept);
+    // Nothing new gets cached past the limit, so there's no use for the buffers
+    if (GlobalCacheLimit && GlobalCacheBytes >= GlobalCacheLimit)
+        BlockAllocator.Trim();
+    UpdateCacheBytes();
+}
+
+void FFMS_AudioSource::ClearCache() {
+    PinnedBlocks.clear();
+    UncachedBlocks.clear();
+    Cache.clear();
+    BlockAllocator.Trim();
+    PermanentBytes = 0;
+    PermanentPackets = 0;
+    NewestBlock = OldestBlock = LastBlock = nullptr;
+    UpdateCacheBytes();
+}
+
+void FFMS_AudioSource::ReserveBlock(AudioBlock &Block, int64_t Count) {
+    size_t Before = Block.AllocatedSize();
+    Block.Reserve(Count);
+    if (Block.Permanent)
+        PermanentBytes += Block.AllocatedSize() - Before;
+    UpdateCacheBytes();
+}
+
+void FFMS_AudioSource::UpdateCacheBytes() {
+    // The permanent blocks can't be evicted, so leaving them out of the
+    // global count keeps them from starving the other sources' caches
+    CacheBytes = BlockAllocator.HeldBytes();
+    size_t Share = CacheBytes - PermanentBytes;
+    GlobalCacheBytes += Share;
+    GlobalCacheBytes -= GlobalShare;
+    GlobalShare = Share;
+}
+
+void FFMS_AudioSource::SetCacheBudget(size_t Bytes) {
+    std::lock_guard<std::mutex> Guard(SourceMutex);
+    CacheBudget = Bytes;
+    EvictBlocks();
 }
 
-int FFMS_AudioSource::DecodeNextBlock(CacheIterator *pos) {
+void FFMS_AudioSource::SetGlobalCacheLimit(size_t Bytes) {
+    GlobalCacheLimit = Bytes;
+}
+
+int FFMS_AudioSource::DecodeNextBlock(bool CacheResult) {
     CurrentFrame = &Frames[PacketNumber];
 
     AVPacket Packet;
@@ -306,8 +718,10 @@ int FFMS_AudioSource::DecodeNextBlock(CacheIterator *pos) {
         //FIXME, is DecodeFrame->nb_samples > 0 always true for decoded frames? I can't be bothered to find out
         NumberOfSamples += DecodeFrame->nb_samples;
         if (DecodeFrame->nb_samples > 0) {
-            if (pos)
-                CachedBlock = CacheBlock(*pos);
+            if (CacheResult && RateConversion)
+                ResampleFrame();
+            else if (CacheResult)
+                CachedBlock = CacheBlock();
         }
     }
 
@@ -316,6 +730,15 @@ int FFMS_AudioSource::DecodeNextBlock(CacheIterator *pos) {
         return NumberOfSamples;
     ++PacketNumber;
 
+    // Short packets are padded with silence before resampling
+    if (CacheResult && RateConversion && ResampleNext >= 0) {
+        const int64_t MissingSamples = CurrentSample + CurrentFrame->SampleCount - ResampleNext;
+        if (MissingSamples > 0) {
+            swr_inject_silence(ResampleContext.get(), static_cast<int>(MissingSamples));
+            ResampleNext += MissingSamples;
+        }
+    }
+
     // Add padding after the packet, if needed
     if (!CachedBlock || CachedBlock->Samples == CurrentFrame->SampleCount)
         return NumberOfSamples;
@@ -324,14 +747,17 @@ int FFMS_AudioSource::DecodeNextBlock(CacheIterator *pos) {
     // This can apparently happen in some rare circumstances, caused by inaccurate seeking?
     if (MissingSamples <= 0)
         return NumberOfSamples;
-    CachedBlock->Samples += MissingSamples;
-    const int64_t MissingBytes = MissingSamples * BytesPerSample;
-    if (MissingSamples > 200 || MissingSamples > CachedBlock->Samples - MissingSamples)
-        memset(CachedBlock->Grow(MissingBytes), 0, MissingBytes);
-    else {
-        auto ptr = CachedBlock->Grow(MissingBytes);
-        memcpy(ptr, ptr - MissingBytes, MissingBytes);
+    ReserveBlock(*CachedBlock, MissingSamples);
+    const bool Silence = MissingSamples > 200 || MissingSamples > CachedBlock->Samples;
+    const size_t MissingBytes = static_cast<size_t>(MissingSamples * CachedBlock->SampleSize);
+    for (int p = 0; p < CachedBlock->Planes; p++) {
+        uint8_t *ptr = CachedBlock->GetPlane(p, CachedBlock->Samples);
+        if (Silence)
+            memset(ptr, 0, MissingBytes);
+        else
+            memcpy(ptr, ptr - MissingBytes, MissingBytes);
     }
+    CachedBlock->Samples += MissingSamples;
     return NumberOfSamples;
 }
 
@@ -339,20 +765,174 @@ static bool SampleStartComp(const FrameInfo &a, const FrameInfo &b) {
     return a.SampleStart < b.SampleStart;
 }
 
+FFMS_AudioSource::AudioBlock *FFMS_AudioSource::GetBlock(int64_t Start) {
+    // Cache has the block we want
+    if (AudioBlock *Block = FindBlock(Start))
+        return Block;
+
+    // Whatever was read from the blocks decoded past the global limit has
+    // been read by now
+    DropUncachedBlocks();
+
+    const int64_t SourceStart = DecodeStart(Start);
+    bool Behind, FarAhead;
+    if (RateConversion) {
+        if (ResampleNext >= 0) {
+            Behind = Start < FFMAX(ResampleOutput, WarmupEnd);
+            FarAhead = Start > ResampleOutput + DecodeFrame->nb_samples * 5 * RateOut / RateIn;
+        } else {
+            Behind = SourceStart < CurrentSample;
+            FarAhead = SourceStart > CurrentSample + DecodeFrame->nb_samples * 5;
+        }
+    } else {
+        Behind = Start < CurrentSample;
+        FarAhead = Start > CurrentSample + DecodeFrame->nb_samples * 5;
+    }
+
+    // Decode another block
+    if (Behind && SeekOffset == -1)
+        throw FFMS_Exception(FFMS_ERROR_SEEKING, FFMS_ERROR_CODEC, "Audio stream is not seekable");
+
+    if (SeekOffset >= 0 && (Behind || FarAhead)) {
+        const AudioSeekPoint &Point = Frames.FindAudioSeekPoint(SourceStart);
+
+        // Only seek forward if it'll actually result in moving forward
+        if (Behind || Point.Packet > PacketNumber) {
+            PacketNumber = Point.Packet;
+            CurrentSample = -1;
+            av_frame_unref(DecodeFrame);
+            avcodec_flush_buffers(CodecContext);
+            Seek(Point.SeekPacket);
+        }
+    }
+
+    // Decode until we hit the block we want
+    if (PacketNumber >= Frames.size() && !RateConversion)
+        throw FFMS_Exception(FFMS_ERROR_SEEKING, FFMS_ERROR_CODEC, "Seeking is severely broken");
+
+    AudioBlock *Block = nullptr;
+    if (RateConversion) {
+        // Resampled blocks don't line up with packets
+        while (!(Block = FindBlock(Start)) && PacketNumber < Frames.size())
+            DecodeNextBlock(true);
+        if (!Block) {
+            FlushResampler();
+            Block = FindBlock(Start);
+        }
+    } else {
+        while (CurrentSample + CurrentFrame->SampleCount <= Start && PacketNumber < Frames.size())
+            DecodeNextBlock(true);
+        Block = FindBlock(Start);
+        if (CurrentSample > Start)
+            Block = nullptr;
+    }
+
+    // The block we want should now be in the cache
+    if (!Block)
+        throw FFMS_Exception(FFMS_ERROR_SEEKING, FFMS_ERROR_CODEC, "Seeking is severely broken");
+    return Block;
+}
+
 void FFMS_AudioSource::GetAudio(void *Buf, int64_t Start, int64_t Count) {
+    std::lock_guard<std::mutex> Guard(SourceMutex);
+
     if (Start < 0 || Start + Count > AP.NumSamples || Count < 0)
         throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_INVALID_ARGUMENT,
             "Out of bounds audio samples requested");
 
-    CacheBeginning();
+    if (!ReadsFromFile())
+        CacheBeginning();
 
-    uint8_t *Dst = static_cast<uint8_t*>(Buf);
+    // Planar output is stored as one plane of Count samples per channel
+    ReadAudio(static_cast<uint8_t*>(Buf), Start, Count, static_cast<size_t>(Count) * (BytesPerSample / OutputPlanes));
+    UpdateReadPosition(Start + Count);
+}
+
+int64_t FFMS_AudioSource::SampleAtTime(double Time) const {
+    // Output sample Delay is the first decoded one, which plays at SourceStart.
+    // Rounding only the time itself means that adjacent ranges always tile
+    // exactly, with no samples dropped or repeated at the boundaries.
+    const int64_t Origin = SourceStart * RateOut / RateIn - Delay;
+    const int64_t Sample = llround(Time * AP.SampleRate) - Origin;
+    return FFMAX(FFMIN(Sample, AP.NumSamples), 0);
+}
+
+int64_t FFMS_AudioSource::GetAudioRange(void *Buf, double StartTime, double EndTime, int64_t MaxSamples) {
+    if (!(StartTime <= EndTime))
+        throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_INVALID_ARGUMENT,
+            "Invalid audio time range requested");
+
+    int64_t Start, Count;
+    {
+        std::lock_guard<std::mutex> Guard(SourceMutex);
+        Start = SampleAtTime(StartTime);
+        Count = SampleAtTime(EndTime) - Start;
+    }
+
+    if (!Buf || !Count)
+        return Count;
+
+    if (Count > MaxSamples)
+        throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_INVALID_ARGUMENT,
+            "The buffer is too small for the requested audio range");
+
+    GetAudio(Buf, Start, Count);
+    return Count;
+}
+
+void FFMS_AudioSource::GetAudioBatch(const FFMS_AudioRange *Ranges, int NumRanges) {
+    std::lock_guard<std::mutex> Guard(SourceMutex);
+
+    for (int i = 0; i < NumRanges; i++) {
+        if (Ranges[i].Start < 0 || Ranges[i].Count < 0 || Ranges[i].Start + Ranges[i].Count > AP.NumSamples)
+            throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_INVALID_ARGUMENT,
+                "Out of bounds audio samples requested");
+    }
+
+    std::vector<int> Order(NumRanges);
+    std::iota(Order.begin(), Order.end(), 0);
+    std::stable_sort(Order.begin(), Order.end(), [&](int a, int b) {
+        return Ranges[a].Start < Ranges[b].Start;
+    });
+
+    if (!ReadsFromFile())
+        CacheBeginning();
+
+    // Going through the ranges in order means GetBlock never has to seek
+    // backwards, and for a gap shorter than the seek pre-roll the seek point
+    // is behind the current packet so it decodes straight through it instead.
+    // Overlapping and adjacent ranges are served from the blocks the previous
+    // one just cached.
+    int64_t End = 0;
+    for (int i : Order) {
+        const FFMS_AudioRange &Range = Ranges[i];
+        if (!Range.Count)
+            continue;
+        ReadAudio(static_cast<uint8_t*>(Range.Buf), Range.Start, Range.Count, static_cast<size_t>(Range.Count) * (BytesPerSample / OutputPlanes));
+        End = FFMAX(End, Range.Start + Range.Count);
+    }
+
+    if (End)
+        UpdateReadPosition(End);
+}
+
+void FFMS_AudioSource::ReadAudio(uint8_t *Dst, int64_t Start, int64_t Count, size_t PlaneSize) {
+    const size_t SampleSize = BytesPerSample / OutputPlanes;
+
+    // The sidecar has the delay applied already
+    if (Sidecar) {
+        const size_t SidecarPlaneSize = static_cast<size_t>(AP.NumSamples) * SampleSize;
+        for (int p = 0; p < OutputPlanes; p++)
+            memcpy(Dst + p * PlaneSize, SidecarData + p * SidecarPlaneSize + Start * SampleSize, static_cast<size_t>(Count) * SampleSize);
+        return;
+    }
 
     // Apply audio delay (if any) and fill any samples before the start time with zero
     Start -= Delay;
     if (Start < 0) {
-        size_t Bytes = static_cast<size_t>(BytesPerSample * FFMIN(-Start, Count));
-        memset(Dst, 0, Bytes);
+        size_t Bytes = static_cast<size_t>(SampleSize * FFMIN(-Start, Count));
+        for (int p = 0; p < OutputPlanes; p++)
+            memset(Dst + p * PlaneSize, 0, Bytes);
 
         Count += Start;
         // Entire request was before the start of the audio
@@ -362,99 +942,462 @@ void FFMS_AudioSource::GetAudio(void *Buf, int64_t Start, int64_t Count) {
         Dst += Bytes;
     }
 
-    auto it = Cache.begin();
+    // The output is the samples as stored in the file
+    if (DirectPCM) {
+        memcpy(Dst, PCMData + Start * BytesPerSample, static_cast<size_t>(Count) * BytesPerSample);
+        return;
+    }
 
     while (Count > 0) {
-        // Find first useful cache block
-        while (it != Cache.end() && it->Start + it->Samples <= Start) ++it;
-
-        // Cache has the next block we want
-        if (it != Cache.end() && it->Start <= Start) {
-            int64_t SrcOffset = FFMAX(0, Start - it->Start);
-            int64_t DstOffset = FFMAX(0, it->Start - Start);
-            int64_t CopySamples = FFMIN(it->Samples - SrcOffset, Count - DstOffset);
-            size_t Bytes = static_cast<size_t>(CopySamples * BytesPerSample);
-
-            memcpy(Dst + DstOffset * BytesPerSample, it->Data.get() + SrcOffset * BytesPerSample, Bytes);
-            Start += CopySamples;
-            Count -= CopySamples;
-            Dst += Bytes;
-            ++it;
+        AudioBlock *Block = GetBlock(Start);
+        int64_t SrcOffset = Start - Block->Start;
+        int64_t CopySamples = FFMIN(Block->Samples - SrcOffset, Count);
+        size_t Bytes = static_cast<size_t>(CopySamples * SampleSize);
+
+        for (int p = 0; p < OutputPlanes; p++)
+            memcpy(Dst + p * PlaneSize, Block->GetPlane(p, SrcOffset), Bytes);
+        Start += CopySamples;
+        Count -= CopySamples;
+        Dst += Bytes;
+        TouchBlock(Block);
+    }
+}
+
+namespace {
+    // Segments shorter than this many seconds aren't worth a decoder of their own
+    const int64_t MinParallelSeconds = 60;
+}
+
+int64_t FFMS_AudioSource::KeyFrameSampleBefore(int64_t Sample) const {
+    // Sample is in the output; packets are indexed in the source rate
+    FrameInfo f;
+    f.SampleStart = FFMAX(Sample - Delay, 0) * RateIn / RateOut;
+    auto it = std::upper_bound(Frames.begin(), Frames.end(), f, SampleStartComp);
+    size_t Packet = it == Frames.begin() ? 0 : std::distance(Frames.begin(), it) - 1;
+    while (Packet > 0 && !Frames[Packet].KeyFrame)
+        --Packet;
+    return Frames[Packet].SampleStart * RateOut / RateIn + Delay;
+}
+
+void FFMS_AudioSource::GetAudioParallel(void *Buf, int64_t Start, int64_t Count, int Threads) {
+    std::lock_guard<std::mutex> Guard(SourceMutex);
+
+    if (Start < 0 || Start + Count > AP.NumSamples || Count < 0)
+        throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_INVALID_ARGUMENT,
+            "Out of bounds audio samples requested");
+
+    if (Threads <= 0)
+        Threads = FFMAX(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    // Each segment has to be decoded from a seek point, which isn't possible
+    // if the track can't be seeked in, and reads from a file are just copies
+    if (SeekOffset < 0 || ReadsFromFile())
+        Threads = 1;
+    Threads = static_cast<int>(FFMIN(Threads, FFMAX(Count / (AP.SampleRate * MinParallelSeconds), 1)));
+
+    // Split at keyframes near the evenly spaced points so that each worker
+    // starts decoding right where its segment begins. The pre-roll from
+    // seeking overlaps the end of the previous segment, and since every
+    // segment is positioned by the SampleStart of the packets in the index
+    // they line up exactly no matter where the splits are.
+    std::vector<int64_t> Splits(1, Start);
+    for (int i = 1; i < Threads; i++) {
+        int64_t Split = KeyFrameSampleBefore(Start + Count / Threads * i);
+        if (Split > Splits.back() && Split < Start + Count)
+            Splits.push_back(Split);
+    }
+    Splits.push_back(Start + Count);
+
+    if (!ReadsFromFile())
+        CacheBeginning();
+
+    const size_t SampleSize = BytesPerSample / OutputPlanes;
+    const size_t PlaneSize = static_cast<size_t>(Count) * SampleSize;
+    uint8_t *Dst = static_cast<uint8_t*>(Buf);
+
+    // Every segment but the first gets a private copy of the source, while
+    // the first is decoded on the calling thread to make use of the cache.
+    // Only the copies whose segment can reach back into the unseekable
+    // beginning of the file have to decode it again for themselves.
+    std::vector<std::exception_ptr> Errors(Splits.size() - 1);
+    std::vector<char> NeedsBeginning(Splits.size() - 1);
+    for (size_t i = 1; i < Splits.size() - 1; i++)
+        NeedsBeginning[i] = SeeksIntoBeginning(Splits[i]);
+    std::vector<std::thread> Workers;
+    auto DecodeSegment = [&](size_t i) {
+        try {
+            FFMS_AudioSource Worker(*this);
+            if (NeedsBeginning[i])
+                Worker.CacheBeginning();
+            Worker.ReadAudio(Dst + (Splits[i] - Start) * SampleSize, Splits[i], Splits[i + 1] - Splits[i], PlaneSize);
+        } catch (...) {
+            Errors[i] = std::current_exception();
+        }
+    };
+
+    try {
+        for (size_t i = 1; i < Splits.size() - 1; i++)
+            Workers.emplace_back(DecodeSegment, i);
+    } catch (std::system_error &) {
+        // Whatever didn't get a thread is decoded here instead
+    }
+
+    try {
+        ReadAudio(Dst, Start, Splits[1] - Start, PlaneSize);
+    } catch (...) {
+        Errors[0] = std::current_exception();
+    }
+    for (size_t i = Workers.size() + 1; i < Splits.size() - 1; i++)
+        DecodeSegment(i);
+
+    for (auto &Worker : Workers)
+        Worker.join();
+
+    for (auto &Error : Errors) {
+        if (Error)
+            std::rethrow_exception(Error);
+    }
+    UpdateReadPosition(Start + Count);
+}
+
+int FFMS_AudioSource::GetAudioSpans(int64_t Start, int64_t Count, FFMS_AudioSpan *Spans, int MaxSpans) {
+    std::lock_guard<std::mutex> Guard(SourceMutex);
+
+    if (Start < 0 || Start + Count > AP.NumSamples || Count < 0)
+        throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_INVALID_ARGUMENT,
+            "Out of bounds audio samples requested");
+    if (MaxSpans <= 0)
+        throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_INVALID_ARGUMENT,
+            "At least one audio span must be requested");
+
+    // The whole range is contiguous in the sidecar
+    if (Sidecar) {
+        const size_t SampleSize = BytesPerSample / OutputPlanes;
+        Spans[0].Data = SidecarData + Start * SampleSize;
+        Spans[0].PlaneStride = OutputPlanes > 1 ? AP.NumSamples * SampleSize : 0;
+        Spans[0].Start = Start;
+        Spans[0].SampleCount = Count;
+        ++SidecarSpans;
+        UpdateReadPosition(Start + Count);
+        return 1;
+    }
+
+    if (!DirectPCM)
+        CacheBeginning();
+
+    int NumSpans = 0;
+
+    // Samples before the start of the audio are returned as a silent span
+    int64_t Pos = Start - Delay;
+    if (Pos < 0 && Count > 0) {
+        int64_t Silence = FFMIN(-Pos, Count);
+        Spans[NumSpans].Data = nullptr;
+        Spans[NumSpans].PlaneStride = 0;
+        Spans[NumSpans].Start = Start;
+        Spans[NumSpans].SampleCount = Silence;
+        ++NumSpans;
+        Pos += Silence;
+        Count -= Silence;
+    }
+
+    // With direct reads the rest is contiguous in the source file, and the
+    // mapping lives as long as the source so there's nothing to pin
+    if (DirectPCM && Count > 0 && NumSpans < MaxSpans) {
+        Spans[NumSpans].Data = PCMData + Pos * BytesPerSample;
+        Spans[NumSpans].PlaneStride = 0;
+        Spans[NumSpans].Start = Pos + Delay;
+        Spans[NumSpans].SampleCount = Count;
+        ++NumSpans;
+        Pos += Count;
+        Count = 0;
+    }
+
+    while (Count > 0 && NumSpans < MaxSpans) {
+        AudioBlock *Block = GetBlock(Pos);
+        int64_t SrcOffset = Pos - Block->Start;
+        int64_t SpanSamples = FFMIN(Block->Samples - SrcOffset, Count);
+
+        Spans[NumSpans].Data = Block->GetPlane(0, SrcOffset);
+        Spans[NumSpans].PlaneStride = Block->Planes > 1 ? Block->PlaneStride() : 0;
+        Spans[NumSpans].Start = Pos + Delay;
+        Spans[NumSpans].SampleCount = SpanSamples;
+        ++NumSpans;
+
+        // Pinned blocks are taken out of the LRU list until they're released
+        if (!Block->Pins++)
+            UnlinkBlock(Block);
+        PinnedBlocks.push_back(Block);
+
+        Pos += SpanSamples;
+        Count -= SpanSamples;
+    }
+    UpdateReadPosition(Pos + Delay);
+    return NumSpans;
+}
+
+void FFMS_AudioSource::UpdateReadPosition(int64_t End) {
+    LastReadEnd = End;
+    if (PrefetchWindow > 0)
+        PrefetchWake.notify_one();
+}
+
+int64_t FFMS_AudioSource::NextPrefetchSample() {
+    if (LastReadEnd < 0 || LastReadEnd == PrefetchFailedAt || ReadsFromFile())
+        return -1;
+
+    // Prefetching more than fits in the cache would only evict itself
+    int64_t Window = PrefetchWindow;
+    if (BytesPerSample)
+        Window = FFMIN(Window, static_cast<int64_t>(CacheBudget / 2 / BytesPerSample));
+
+    // Cache positions don't include the delay
+    int64_t Pos = FFMAX(LastReadEnd - Delay, 0);
+    int64_t End = FFMIN(LastReadEnd + Window, AP.NumSamples) - Delay;
+    while (Pos < End) {
+        AudioBlock *Block = FindBlock(Pos);
+        if (!Block)
+            return Pos;
+        Pos = Block->Start + Block->Samples;
+    }
+    return -1;
+}
+
+void FFMS_AudioSource::PrefetchLoop() {
+    std::unique_lock<std::mutex> Guard(SourceMutex);
+    while (!PrefetchStop) {
+        int64_t Next = NextPrefetchSample();
+        if (Next < 0) {
+            PrefetchWake.wait(Guard);
+            continue;
         }
-        // Decode another block
-        else {
-            if (Start < CurrentSample && SeekOffset == -1)
-                throw FFMS_Exception(FFMS_ERROR_SEEKING, FFMS_ERROR_CODEC, "Audio stream is not seekable");
-
-            if (SeekOffset >= 0 && (Start < CurrentSample || Start > CurrentSample + DecodeFrame->nb_samples * 5)) {
-                FrameInfo f;
-                f.SampleStart = Start;
-                size_t NewPacketNumber = std::distance(
-                    Frames.begin(),
-                    std::lower_bound(Frames.begin(), Frames.end(), f, SampleStartComp));
-                NewPacketNumber = NewPacketNumber > static_cast<size_t>(SeekOffset + 15)
-                    ? NewPacketNumber - SeekOffset - 15
-                    : 0;
-                while (NewPacketNumber > 0 && !Frames[NewPacketNumber].KeyFrame) --NewPacketNumber;
-
-                // Only seek forward if it'll actually result in moving forward
-                if (Start < CurrentSample || static_cast<size_t>(NewPacketNumber) > PacketNumber) {
-                    PacketNumber = NewPacketNumber;
-                    CurrentSample = -1;
-                    av_frame_unref(DecodeFrame);
-                    avcodec_flush_buffers(CodecContext);
-                    Seek();
+
+        try {
+            CacheBeginning();
+            GetBlock(Next);
+        } catch (...) {
+            // Reading the same range will run into the same error, so leave
+            // reporting it to the reader
+            PrefetchFailedAt = LastReadEnd;
+            continue;
+        }
+
+        // Give waiting readers a chance to get in between blocks
+        Guard.unlock();
+        std::this_thread::yield();
+        Guard.lock();
+    }
+}
+
+void FFMS_AudioSource::StopPrefetch() {
+    {
+        std::lock_guard<std::mutex> Guard(SourceMutex);
+        PrefetchStop = true;
+    }
+    PrefetchWake.notify_all();
+    if (PrefetchThread.joinable())
+        PrefetchThread.join();
+}
+
+void FFMS_AudioSource::SetPrefetch(int64_t Samples) {
+    if (Samples < 0)
+        throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_INVALID_ARGUMENT,
+            "Invalid audio prefetch window");
+
+    StopPrefetch();
+    PrefetchStop = false;
+    PrefetchWindow = Samples;
+    if (!Samples)
+        return;
+
+    try {
+        PrefetchThread = std::thread(&FFMS_AudioSource::PrefetchLoop, this);
+    } catch (std::system_error &) {
+        PrefetchWindow = 0;
+        throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_ALLOCATION_FAILED,
+            "Could not start the audio prefetch thread");
+    }
+}
+
+void FFMS_AudioSource::ReleaseAudioSpans() {
+    std::lock_guard<std::mutex> Guard(SourceMutex);
+    for (AudioBlock *Block : PinnedBlocks) {
+        if (!--Block->Pins)
+            TouchBlock(Block);
+    }
+    PinnedBlocks.clear();
+    SidecarSpans = 0;
+    EvictBlocks();
+}
+
+namespace {
+    // Frames computed per read from the cache, which bounds the size of the
+    // intermediate buffers
+    const int SpectrogramChunkFrames = 256;
+}
+
+void FFMS_AudioSource::GetSpectrogram(const FFMS_SpectrogramOptions &Options, const int64_t *Starts, const int *NumFrames, int NumRanges, float *Out) {
+    for (int r = 0; r < NumRanges; r++) {
+        if (Starts[r] < 0 || NumFrames[r] < 0)
+            throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_INVALID_ARGUMENT,
+                "Invalid spectrogram range");
+    }
+
+    Spectrogram Spec(Options, AP.SampleRate);
+    const int Bins = Spec.GetBins();
+    std::vector<uint8_t> Samples;
+    std::vector<float> Mono;
+
+    for (int r = 0; r < NumRanges; r++) {
+        for (int f = 0; f < NumFrames[r]; f += SpectrogramChunkFrames) {
+            const int Frames = FFMIN(SpectrogramChunkFrames, NumFrames[r] - f);
+            const int64_t Start = Starts[r] + static_cast<int64_t>(f) * Options.HopSize;
+            const int64_t Count = static_cast<int64_t>(Frames - 1) * Options.HopSize + Options.WindowSize;
+
+            // Frames running past the end of the audio are padded with silence
+            Mono.assign(static_cast<size_t>(Count), 0.f);
+            {
+                std::lock_guard<std::mutex> Guard(SourceMutex);
+                const int64_t Available = FFMAX(FFMIN(Count, AP.NumSamples - Start), 0);
+                if (Available > 0) {
+                    if (!ReadsFromFile())
+                        CacheBeginning();
+                    const size_t PlaneSize = static_cast<size_t>(Available) * (BytesPerSample / OutputPlanes);
+                    Samples.resize(PlaneSize * OutputPlanes);
+                    ReadAudio(Samples.data(), Start, Available, PlaneSize);
+                    UpdateReadPosition(Start + Available);
+                    MixToMono(Samples.data(), PlaneSize, static_cast<AVSampleFormat>(OutputOptions.SampleFormat), OutputChannels, static_cast<size_t>(Available), Mono.data());
                 }
             }
 
-            // Decode until we hit the block we want
-            if (PacketNumber >= Frames.size())
-                throw FFMS_Exception(FFMS_ERROR_SEEKING, FFMS_ERROR_CODEC, "Seeking is severely broken");
-            while (CurrentSample + CurrentFrame->SampleCount <= Start && PacketNumber < Frames.size())
-                DecodeNextBlock(&it);
-            if (CurrentSample > Start)
-                throw FFMS_Exception(FFMS_ERROR_SEEKING, FFMS_ERROR_CODEC, "Seeking is severely broken");
-
-            // The block we want is now in the cache immediately before it
-            --it;
+            for (int i = 0; i < Frames; i++) {
+                Spec.ComputeFrame(Mono.data() + static_cast<size_t>(i) * Options.HopSize, Out);
+                Out += Bins;
+            }
         }
     }
 }
 
-size_t FFMS_AudioSource::GetSeekablePacketNumber(FFMS_Track const& Frames, size_t PacketNumber) {
-    // Packets don't always have unique PTSes, so we may not be able to
-    // uniquely identify the packet we want. This function attempts to find
-    // a PTS we can seek to which will let us figure out which packet we're
-    // on before we get to the packet we actually wanted
+namespace {
+    const uint32_t SidecarMagic = 0x4D435046; // FPCM
+    const uint32_t SidecarVersion = 2;
+    // Keeps the samples page aligned
+    const size_t SidecarHeaderSize = 4096;
+
+    struct SidecarHeader {
+        uint32_t Magic;
+        uint32_t Version;
+        int64_t Filesize;
+        uint8_t Digest[20];
+        int32_t Track;
+        int64_t ChannelLayout;
+        int32_t SampleFormat;
+        int32_t SampleRate;
+        int64_t NumSamples;
+        int64_t Delay;
+        // The remaining resampler settings change the decoded samples too.
+        // Fields are ordered so the struct has no padding for memcmp to see.
+        double CenterMixLevel;
+        double SurroundMixLevel;
+        double LFEMixLevel;
+        double CutoffFrequencyRatio;
+        int32_t MixingCoefficientType;
+        int32_t Normalize;
+        int32_t ForceResample;
+        int32_t ResampleFilterSize;
+        int32_t ResamplePhaseShift;
+        int32_t LinearInterpolation;
+        int32_t MatrixedStereoEncoding;
+        int32_t FilterType;
+        int32_t KaiserBeta;
+        int32_t DitherMethod;
+    };
+    static_assert(sizeof(SidecarHeader) == 144, "SidecarHeader must not contain padding");
+}
 
-    // MatroskaAudioSource doesn't need this, as it seeks by byte offset
-    // rather than PTS. LAVF theoretically can seek by byte offset, but we
-    // don't use it as not all demuxers support it and it's broken in some of
-    // those that claim to support it
+void FFMS_AudioSource::SetSidecar(const char *Filename) {
+    std::lock_guard<std::mutex> Guard(SourceMutex);
+
+    if (SidecarSpans)
+        throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_USER,
+            "Audio spans must be released before changing the sidecar file");
+
+    Sidecar.reset();
+    SidecarData = nullptr;
+    if (!Filename)
+        return;
+
+    SidecarHeader Header = {};
+    Header.Magic = SidecarMagic;
+    Header.Version = SidecarVersion;
+    Header.Filesize = SourceFilesize;
+    memcpy(Header.Digest, SourceDigest, sizeof(Header.Digest));
+    Header.Track = TrackNumber;
+    Header.ChannelLayout = OutputOptions.ChannelLayout;
+    Header.SampleFormat = OutputOptions.SampleFormat;
+    Header.SampleRate = AP.SampleRate;
+    Header.NumSamples = AP.NumSamples;
+    Header.Delay = Delay;
+    Header.CenterMixLevel = OutputOptions.CenterMixLevel;
+    Header.SurroundMixLevel = OutputOptions.SurroundMixLevel;
+    Header.LFEMixLevel = OutputOptions.LFEMixLevel;
+    Header.CutoffFrequencyRatio = OutputOptions.CutoffFrequencyRatio;
+    Header.MixingCoefficientType = OutputOptions.MixingCoefficientType;
+    Header.Normalize = OutputOptions.Normalize;
+    Header.ForceResample = OutputOptions.ForceResample;
+    Header.ResampleFilterSize = OutputOptions.ResampleFilterSize;
+    Header.ResamplePhaseShift = OutputOptions.ResamplePhaseShift;
+    Header.LinearInterpolation = OutputOptions.LinearInterpolation;
+    Header.MatrixedStereoEncoding = OutputOptions.MatrixedStereoEncoding;
+    Header.FilterType = OutputOptions.FilterType;
+    Header.KaiserBeta = OutputOptions.KaiserBeta;
+    Header.DitherMethod = OutputOptions.DitherMethod;
+
+    const uint64_t DataSize = static_cast<uint64_t>(AP.NumSamples) * BytesPerSample;
+    if (DataSize > SIZE_MAX - SidecarHeaderSize)
+        throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_ALLOCATION_FAILED,
+            "Audio track is too large to map into memory");
+    const size_t FileSize = SidecarHeaderSize + static_cast<size_t>(DataSize);
 
-    // However much we might wish to, we can't seek to before packet zero
-    if (PacketNumber == 0) return PacketNumber;
+    // Reuse the file if it was created for the same audio, and decode the
+    // track into it otherwise
+    std::unique_ptr<MappedFile> Existing;
+    try {
+        Existing.reset(new MappedFile(Filename, FFMS_ERROR_DECODING));
+    } catch (FFMS_Exception &) {
+    }
 
-    // Desired packet's PTS is unique, so don't do anything
-    if (Frames[PacketNumber].PTS != Frames[PacketNumber - 1].PTS &&
-        (PacketNumber + 1 == Frames.size() || Frames[PacketNumber].PTS != Frames[PacketNumber + 1].PTS))
-        return PacketNumber;
+    if (!Existing || Existing->GetSize() != FileSize || memcmp(Existing->GetData(), &Header, sizeof(Header))) {
+        Existing.reset();
+        CreateSidecar(Filename, &Header, sizeof(Header));
+        Existing.reset(new MappedFile(Filename, FFMS_ERROR_DECODING));
+    }
 
-    // When decoding, we only reliably know what packet we're at when the
-    // newly parsed packet has a different PTS from the previous one. As such,
-    // we walk backwards until we hit a different PTS and then seek to there,
-    // so that we can then decode until we hit the PTS group we actually wanted
-    // (and thereby know that we're at the first packet in the group rather
-    // than whatever the splitter happened to choose)
+    Sidecar = std::move(Existing);
+    SidecarData = Sidecar->GetData() + SidecarHeaderSize;
+}
 
-    // This doesn't work if our desired packet has the same PTS as the first
-    // packet, but this scenario should never come up anyway; we permanently
-    // cache the decoded results from those packets, so there's no need to ever
-    // seek to them
-    int64_t PTS = Frames[PacketNumber].PTS;
-    while (PacketNumber > 0 && PTS == Frames[PacketNumber].PTS)
-        --PacketNumber;
-    return PacketNumber;
+void FFMS_AudioSource::CreateSidecar(const char *Filename, const void *Header, size_t HeaderSize) {
+    // Write to a temporary file which is only renamed once it's complete, so
+    // an interrupted write never leaves behind a valid looking sidecar
+    std::string TempFile = std::string(Filename) + ".tmp";
+    {
+        MappedFile Out(TempFile.c_str(), SidecarHeaderSize + static_cast<size_t>(AP.NumSamples) * BytesPerSample, FFMS_ERROR_DECODING);
+        try {
+            CacheBeginning();
+            ReadAudio(Out.GetData() + SidecarHeaderSize, 0, AP.NumSamples, static_cast<size_t>(AP.NumSamples) * (BytesPerSample / OutputPlanes));
+            memcpy(Out.GetData(), Header, HeaderSize);
+            Out.Flush(FFMS_ERROR_DECODING);
+        } catch (...) {
+            remove(TempFile.c_str());
+            throw;
+        }
+    }
+
+    remove(Filename);
+    if (rename(TempFile.c_str(), Filename)) {
+        remove(TempFile.c_str());
+        throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_FILE_WRITE,
+            std::string("Failed to write '") + Filename + "'");
+    }
 }
 
 void FFMS_AudioSource::OpenFile() {
@@ -483,12 +1426,14 @@ void FFMS_AudioSource::OpenFile() {
 }
 
 void FFMS_AudioSource::Free() {
+    ClearCache();
     av_frame_free(&DecodeFrame);
     avcodec_free_context(&CodecContext);
     avformat_close_input(&FormatContext);
 }
 
 FFMS_AudioSource::~FFMS_AudioSource() {
+    StopPrefetch();
     Free();
 }
 
@@ -496,9 +1441,10 @@ int64_t FFMS_AudioSource::FrameTS(size_t Packet) const {
     return Frames.HasTS ? Frames[Packet].PTS : Frames[Packet].FilePos;
 }
 
-void FFMS_AudioSource::Seek() {
-    size_t TargetPacket = GetSeekablePacketNumber(Frames, PacketNumber);
+void FFMS_AudioSource::Seek(size_t TargetPacket) {
     LastValidTS = AV_NOPTS_VALUE;
+    LastBlock = nullptr;
+    ResampleNext = -1;
 
     int Flags = Frames.HasTS ? AVSEEK_FLAG_BACKWARD : AVSEEK_FLAG_BACKWARD | AVSEEK_FLAG_BYTE;
 
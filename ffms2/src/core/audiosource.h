@@ -23,60 +23,158 @@
 
 #include "utils.h"
 #include "track.h"
+#include "audioconvert.h"
+#include "mappedfile.h"
 
-#include <list>
+#include <map>
 #include <vector>
 #include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Hands out audio block buffers of exactly the requested size and keeps a
+// few freed buffers around for reuse, so that decoding doesn't have to go
+// through malloc for every block. Blocks of a track are nearly all the same
+// size, so exact matches are the common case.
+class AudioBlockAllocator {
+public:
+    struct Release {
+        AudioBlockAllocator *Owner = nullptr;
+        size_t Size = 0;
+        void operator()(uint8_t *ptr) const {
+            Owner->Recycle(ptr, Size);
+        }
+    };
+    typedef std::unique_ptr<uint8_t, Release> Pointer;
+
+    AudioBlockAllocator() = default;
+    AudioBlockAllocator(const AudioBlockAllocator &) = delete;
+    AudioBlockAllocator &operator=(const AudioBlockAllocator &) = delete;
+    ~AudioBlockAllocator();
+
+    Pointer Allocate(size_t Size);
+    // Free the buffers kept for reuse
+    void Trim();
+
+    // Size of all buffers handed out and of the ones kept for reuse
+    size_t HeldBytes() const { return Held; }
+    size_t FreeBytes() const { return Free; }
+
+private:
+    void Recycle(uint8_t *ptr, size_t Size);
+    // Least recently freed first
+    std::vector<std::pair<size_t, uint8_t *>> FreeBuffers;
+    size_t Held = 0;
+    size_t Free = 0;
+};
 
 struct FFMS_AudioSource {
     struct AudioBlock {
-        struct Free {
-            void operator()(uint8_t *ptr) const {
-                free(ptr);
-            }
-        };
-
-        int64_t Age;
         int64_t Start;
         int64_t Samples = 0;
-        size_t DataSize = 0;
-        std::unique_ptr<uint8_t, Free> Data;
+        // Bytes per sample in each plane and the number of planes, which is
+        // one for packed formats and the number of channels for planar ones
+        size_t SampleSize;
+        int Planes;
+        // Number of samples each plane has room for
+        int64_t SampleCapacity = 0;
+        AudioBlockAllocator::Pointer Data;
+
+        // Blocks from the unseekable beginning of the file are never evicted
+        // and aren't part of the LRU list, and neither are pinned ones or
+        // ones decoded past the global cache limit
+        bool Permanent = false;
+        bool Uncached = false;
+        int Pins = 0;
+        AudioBlock *Newer = nullptr;
+        AudioBlock *Older = nullptr;
+
+        // Blocks are allocated at the size the index says the packet will
+        // decode to, so growing only has to copy when the decoder returns
+        // more samples than expected
+        AudioBlock(int64_t Start, AudioBlockAllocator &Allocator, int64_t Capacity, size_t SampleSize, int Planes)
+            : Start(Start), SampleSize(SampleSize), Planes(Planes) {
+            Data = Allocator.Allocate(Capacity * SampleSize * Planes);
+            SampleCapacity = Capacity;
+        }
+
+        size_t AllocatedSize() const {
+            return SampleCapacity * SampleSize * Planes;
+        }
 
-        AudioBlock(int64_t Start)
-            : Start(Start) {
-            static std::atomic<int64_t> Now{ 0 };
-            Age = Now++;
+        size_t PlaneStride() const {
+            return SampleCapacity * SampleSize;
         }
 
-        uint8_t *Grow(size_t size) {
-            auto ptr = static_cast<uint8_t *>(realloc(Data.get(), DataSize + size));
-            if (!ptr)
-                throw std::bad_alloc();
-            Data.release();
-            Data.reset(ptr);
-            ptr += DataSize;
-            DataSize += size;
-            return ptr;
+        uint8_t *GetPlane(int Plane, int64_t Sample) const {
+            return Data.get() + Plane * PlaneStride() + Sample * SampleSize;
+        }
+
+        // Make room for Count more samples after the current ones
+        void Reserve(int64_t Count) {
+            if (Samples + Count <= SampleCapacity)
+                return;
+            int64_t NewCapacity = Samples + Count;
+            auto NewData = Data.get_deleter().Owner->Allocate(NewCapacity * SampleSize * Planes);
+            for (int p = 0; p < Planes; p++)
+                memcpy(NewData.get() + p * NewCapacity * SampleSize, GetPlane(p, 0), Samples * SampleSize);
+            Data = std::move(NewData);
+            SampleCapacity = NewCapacity;
         }
     };
-    typedef std::list<AudioBlock>::iterator CacheIterator;
 
     AVFormatContext *FormatContext = nullptr;
     int64_t LastValidTS;
     std::string SourceFile;
 
-    // delay in samples to apply to the audio
+    // delay in samples to apply to the audio, in the output and source sample rates
     int64_t Delay = 0;
-    // cache of decoded audio blocks
-    std::list<AudioBlock> Cache;
-    // max size of the cache in blocks
-    size_t MaxCacheBlocks = 50;
-    // pointer to last element of the cache which should never be deleted
-    CacheIterator CacheNoDelete;
+    int64_t SourceDelay = 0;
+    // position of the first decoded sample relative to time zero, in source samples
+    int64_t SourceStart = 0;
+    // sample rate and number of samples of the decoded audio
+    int SourceSampleRate = 0;
+    int64_t SourceSamples = 0;
+    // storage for the cached blocks, which must outlive them
+    AudioBlockAllocator BlockAllocator;
+    // cache of decoded audio blocks, keyed by their first sample
+    std::map<int64_t, AudioBlock> Cache;
+    // max size of the evictable part of the cache in bytes
+    size_t CacheBudget = 16 * 1024 * 1024;
+    // memory held by the cache in bytes, counting the allocated size of the
+    // blocks and the freed buffers kept for reuse, and the part of it used
+    // by the permanent blocks
+    size_t CacheBytes = 0;
+    size_t PermanentBytes = 0;
+    // this source's share of GlobalCacheBytes
+    size_t GlobalShare = 0;
+    // set while caching the beginning of the file so those blocks are kept
+    bool CachePermanent = false;
+    // number of packets from the start of the file held in the permanent blocks
+    size_t PermanentPackets = 0;
+    // evictable blocks in least recently used order
+    AudioBlock *NewestBlock = nullptr;
+    AudioBlock *OldestBlock = nullptr;
+    // block which the frames of the packet being decoded are appended to
+    AudioBlock *LastBlock = nullptr;
+    // blocks referenced by spans returned by GetAudioSpans, once per span
+    std::vector<AudioBlock *> PinnedBlocks;
+    // blocks decoded while the global cache limit was reached, which are
+    // dropped again before the next decode instead of being cached
+    std::vector<AudioBlock *> UncachedBlocks;
     // bytes per sample * number of channels, *after* resampling if applicable
     size_t BytesPerSample = 0;
+    // number of output channels and of planes they're stored in
+    int OutputChannels = 0;
+    int OutputPlanes = 1;
+    // write pointers for each output plane, reused for every frame
+    std::vector<uint8_t *> OutputPointers;
 
+    // Conversions which only change the sample format or layout don't need
+    // swresample
     bool NeedsResample = false;
+    SampleConverter Converter = nullptr;
 
     struct SwrFreeWrapper {
         void operator()(SwrContext *c) const {
@@ -87,17 +185,129 @@ struct FFMS_AudioSource {
     typedef std::unique_ptr<SwrContext, SwrFreeWrapper> FFResampleContext;
     FFResampleContext ResampleContext;
 
+    // Sample rate conversion. Output sample n * RateOut / RateIn corresponds to
+    // source sample n, with the ratio reduced so that restarting the
+    // resampler at a multiple of RateIn gives the same output as a pass from
+    // the start of the file once the filter has warmed up.
+    bool RateConversion = false;
+    int64_t RateIn = 1;
+    int64_t RateOut = 1;
+    // source samples needed to warm up the filter, and the corresponding
+    // number of output samples which aren't cached after a restart
+    int64_t WarmupSamples = 0;
+    int64_t WarmupOutput = 0;
+    // next source sample the resampler expects, -1 if it needs a restart
+    int64_t ResampleNext = -1;
+    // output position of the next sample the resampler returns and the
+    // first one after the warmup
+    int64_t ResampleOutput = 0;
+    int64_t WarmupEnd = 0;
+    std::vector<const uint8_t *> InputPointers;
+    std::vector<uint8_t> ResampleBuffer;
+
+    // Feed the current audio frame to the resampler and cache its output
+    void ResampleFrame();
+    // Cache Count samples of resampler output stored in OutputPointers
+    void CacheResampled(int64_t Count);
+    // Drain the resampler at the end of the file
+    void FlushResampler();
+    // Update Delay and the output sample count after a rate change
+    void UpdateSampleCounts();
+    // Output sample which plays at the given time in seconds
+    int64_t SampleAtTime(double Time) const;
+
+    // Read-ahead. The public functions hold SourceMutex, and the prefetch
+    // thread takes it for one block at a time so reads only ever wait for
+    // the block currently being decoded.
+    std::mutex SourceMutex;
+    std::thread PrefetchThread;
+    std::condition_variable PrefetchWake;
+    bool PrefetchStop = false;
+    // number of samples to keep decoded after the last read
+    int64_t PrefetchWindow = 0;
+    // end of the last read, -1 before the first one
+    int64_t LastReadEnd = -1;
+    // read position at which prefetching last failed, so it isn't retried
+    int64_t PrefetchFailedAt = -1;
+
+    void PrefetchLoop();
+    // First uncached sample in the prefetch window, or -1
+    int64_t NextPrefetchSample();
+    void StopPrefetch();
+    void UpdateReadPosition(int64_t End);
+
+    // Options the output format was last set with, for making copies
+    FFMS_ResampleOptions OutputOptions = {};
+
+    // Signature of the source file, which sidecar files are keyed by
+    int64_t SourceFilesize = 0;
+    uint8_t SourceDigest[20] = {};
+    // The whole track decoded to a file in the output format. While open all
+    // reads are served from it instead of the decoder and cache.
+    std::unique_ptr<MappedFile> Sidecar;
+    const uint8_t *SidecarData = nullptr;
+    // spans returned by GetAudioSpans pointing into the sidecar file
+    int SidecarSpans = 0;
+    void CreateSidecar(const char *Filename, const void *Header, size_t HeaderSize);
+
+    // Tracks which are a single run of PCM samples in the file are mapped,
+    // and while the output format is the stored one reads are served by
+    // copying straight from the mapping
+    std::unique_ptr<MappedFile> PCMFile;
+    const uint8_t *PCMData = nullptr;
+    bool DirectPCM = false;
+    void OpenPCM();
+
+    bool ReadsFromFile() const { return Sidecar || DirectPCM; }
+
+    // Copy for decoding another part of the same track in parallel, which
+    // shares the index data but nothing else
+    FFMS_AudioSource(const FFMS_AudioSource &Source);
+    // Output position of the keyframe at or before the given output sample
+    int64_t KeyFrameSampleBefore(int64_t Sample) const;
+    // Copy Count samples starting at Start to Dst, where planes are
+    // PlaneSize bytes apart
+    void ReadAudio(uint8_t *Dst, int64_t Start, int64_t Count, size_t PlaneSize);
+
     // Insert the current audio frame into the cache
-    AudioBlock *CacheBlock(CacheIterator &pos);
+    AudioBlock *CacheBlock();
+    // Add an empty block for Start to the cache
+    AudioBlock *NewBlock(int64_t Start, int64_t Capacity);
 
-    // Interleave the current audio frame and insert it into the cache
-    void ResampleAndCache(CacheIterator pos);
+    // Convert the current audio frame to the output format and append it to the block
+    void ResampleAndCache(AudioBlock &block);
+
+    // Find the cached block containing the given sample, if any
+    AudioBlock *FindBlock(int64_t Sample);
+    // Find the block containing the given sample, decoding it if needed
+    AudioBlock *GetBlock(int64_t Start);
+    // Mark a block as the most recently used one
+    void TouchBlock(AudioBlock *Block);
+    void UnlinkBlock(AudioBlock *Block);
+    // Drop least recently used blocks until the cache is within its limits
+    void EvictBlocks();
+    void DropUncachedBlocks();
+    void ClearCache();
+    // Make room for Count more samples in the block, keeping the byte counts up to date
+    void ReserveBlock(AudioBlock &Block, int64_t Count);
+    // Bring the byte counts in line with what the allocator holds
+    void UpdateCacheBytes();
+
+    // Combined size of the evictable parts of the caches of all audio
+    // sources and the cap on it
+    static std::atomic<size_t> GlobalCacheBytes;
+    static std::atomic<size_t> GlobalCacheLimit;
 
     // Cache the unseekable beginning of the file once the output format is set
     void CacheBeginning();
+    // Whether decoding output sample Start, without the delay applied, may
+    // seek into or decode from the cached beginning of the file
+    bool SeeksIntoBeginning(int64_t Start) const;
+    // First source sample which has to be decoded to produce output sample Start
+    int64_t DecodeStart(int64_t Start) const;
 
-    // Called after seeking
-    void Seek();
+    // Seek the demuxer to TargetPacket and decode up to PacketNumber
+    void Seek(size_t TargetPacket);
     // Read the next packet from the file
     bool ReadPacket(AVPacket *);
 
@@ -125,7 +335,7 @@ struct FFMS_AudioSource {
     AVCodecContext *CodecContext = nullptr;
     FFMS_AudioProperties AP = {};
 
-    int DecodeNextBlock(CacheIterator *cachePos = 0);
+    int DecodeNextBlock(bool CacheResult = false);
     // Initialization which has to be done after the codec is opened
     void Init(const FFMS_Index &Index, int DelayMode);
 
@@ -138,11 +348,23 @@ public:
     FFMS_Track *GetTrack() { return &Frames; }
     const FFMS_AudioProperties& GetAudioProperties() const { return AP; }
     void GetAudio(void *Buf, int64_t Start, int64_t Count);
+    void GetAudioParallel(void *Buf, int64_t Start, int64_t Count, int Threads);
+    // Returns the number of samples between the two times, and reads them into
+    // Buf unless it's null
+    int64_t GetAudioRange(void *Buf, double StartTime, double EndTime, int64_t MaxSamples);
+    void GetAudioBatch(const FFMS_AudioRange *Ranges, int NumRanges);
+    int GetAudioSpans(int64_t Start, int64_t Count, FFMS_AudioSpan *Spans, int MaxSpans);
+    void ReleaseAudioSpans();
+    void SetCacheBudget(size_t Bytes);
+    static void SetGlobalCacheLimit(size_t Bytes);
+    void SetPrefetch(int64_t Samples);
+    void SetSidecar(const char *Filename);
+    // Writes NumFrames[i] frames starting at Starts[i] for each range, one
+    // after another
+    void GetSpectrogram(const FFMS_SpectrogramOptions &Options, const int64_t *Starts, const int *NumFrames, int NumRanges, float *Out);
 
     std::unique_ptr<FFMS_ResampleOptions> CreateResampleOptions() const;
     void SetOutputFormat(FFMS_ResampleOptions const& opt);
-
-    static size_t GetSeekablePacketNumber(FFMS_Track const& Frames, size_t PacketNumber);
 };
 
 #endif
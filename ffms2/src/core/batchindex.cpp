@@ -0,0 +1,144 @@
+//  Copyright (c) 2026 The FFmpegSource Project
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "batchindex.h"
+
+#include "indexing.h"
+#include "track.h"
+#include "utils.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace {
+
+class BatchIndexer {
+    const char * const *SourceFiles;
+    const char * const *IndexFiles;
+    int NumFiles;
+    bool IndexAudio;
+    int ErrorHandling;
+    TBatchIndexCallback BIC;
+    void *BIPrivate;
+
+    std::atomic<int> NextFile{0};
+    std::atomic<bool> Cancelled{false};
+    // Serializes the callback so the caller doesn't have to
+    std::mutex CallbackMutex;
+
+    int64_t IndexFile(int File);
+    void Report(int File, int64_t Bytes, double Seconds, const FFMS_ErrorInfo &FileError);
+
+public:
+    BatchIndexer(const char * const *SourceFiles, const char * const *IndexFiles, int NumFiles, bool IndexAudio, int ErrorHandling, TBatchIndexCallback BIC, void *BIPrivate)
+        : SourceFiles(SourceFiles), IndexFiles(IndexFiles), NumFiles(NumFiles), IndexAudio(IndexAudio)
+        , ErrorHandling(ErrorHandling), BIC(BIC), BIPrivate(BIPrivate) {}
+
+    void Work();
+    bool WasCancelled() const { return Cancelled; }
+};
+
+int64_t BatchIndexer::IndexFile(int File) {
+    FFMS_Indexer Indexer(SourceFiles[File]);
+    Indexer.SetErrorHandling(ErrorHandling);
+    // The indexer includes the audio tracks by default
+    Indexer.SetIndexTrackType(FFMS_TYPE_AUDIO, IndexAudio);
+
+    std::unique_ptr<FFMS_Index> Index(Indexer.DoIndexing());
+    if (IndexFiles && IndexFiles[File])
+        Index->WriteIndexFile(IndexFiles[File]);
+    else
+        Index->WriteIndexFile((std::string(SourceFiles[File]) + ".ffindex").c_str());
+    return Index->Filesize;
+}
+
+void BatchIndexer::Report(int File, int64_t Bytes, double Seconds, const FFMS_ErrorInfo &FileError) {
+    if (!BIC)
+        return;
+    std::lock_guard<std::mutex> Guard(CallbackMutex);
+    if (BIC(File, Bytes, Seconds, &FileError, BIPrivate))
+        Cancelled = true;
+}
+
+void BatchIndexer::Work() {
+    char ErrorMsg[1024];
+    FFMS_ErrorInfo FileError;
+    FileError.Buffer = ErrorMsg;
+    FileError.BufferSize = sizeof(ErrorMsg);
+
+    for (int File = NextFile++; File < NumFiles && !Cancelled; File = NextFile++) {
+        ClearErrorInfo(&FileError);
+        int64_t Bytes = 0;
+        auto Start = std::chrono::steady_clock::now();
+        try {
+            Bytes = IndexFile(File);
+        } catch (FFMS_Exception &e) {
+            e.CopyOut(&FileError);
+        } catch (std::bad_alloc &) {
+            FFMS_Exception(FFMS_ERROR_INDEXING, FFMS_ERROR_ALLOCATION_FAILED,
+                "Out of memory").CopyOut(&FileError);
+        } catch (std::exception &e) {
+            FFMS_Exception(FFMS_ERROR_INDEXING, FFMS_ERROR_UNKNOWN,
+                e.what()).CopyOut(&FileError);
+        } catch (...) {
+            // Escaping a worker thread would take the whole process down
+            FFMS_Exception(FFMS_ERROR_INDEXING, FFMS_ERROR_UNKNOWN,
+                "Unknown error").CopyOut(&FileError);
+        }
+        Report(File, Bytes, std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count(), FileError);
+    }
+}
+
+}
+
+void IndexFiles(const char * const *SourceFiles, const char * const *IndexFiles, int NumFiles, bool IndexAudio, int ErrorHandling, int Threads, TBatchIndexCallback BIC, void *BIPrivate) {
+    if (NumFiles < 0 || (NumFiles > 0 && !SourceFiles))
+        throw FFMS_Exception(FFMS_ERROR_INDEXING, FFMS_ERROR_INVALID_ARGUMENT,
+            "Invalid list of files to index");
+
+    if (Threads <= 0)
+        Threads = FFMAX(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    Threads = FFMIN(Threads, FFMAX(NumFiles, 1));
+
+    // The calling thread is one of the workers
+    BatchIndexer Batch(SourceFiles, IndexFiles, NumFiles, IndexAudio, ErrorHandling, BIC, BIPrivate);
+    std::vector<std::thread> Workers;
+    try {
+        for (int i = 1; i < Threads; i++)
+            Workers.emplace_back(&BatchIndexer::Work, &Batch);
+    } catch (std::system_error &) {
+        // Make do with the threads we got
+    }
+
+    Batch.Work();
+    for (auto &Worker : Workers)
+        Worker.join();
+
+    if (Batch.WasCancelled())
+        throw FFMS_Exception(FFMS_ERROR_CANCELLED, FFMS_ERROR_USER,
+            "Cancelled by user");
+}
@@ -20,8 +20,12 @@
 
 #include "ffms.h"
 
+#include "audioextract.h"
 #include "audiosource.h"
+#include "batchindex.h"
+#include "framepool.h"
 #include "indexing.h"
+#include "spectrogram.h"
 #include "videosource.h"
 #include "videoutils.h"
 
@@ -30,6 +34,7 @@ extern "C" {
 #include <libavutil/pixdesc.h>
 }
 
+#include <algorithm>
 #include <mutex>
 #include <sstream>
 #include <iomanip>
@@ -117,6 +122,15 @@ FFMS_API(void) FFMS_SetLogLevel(int Level) {
     av_log_set_level(Level);
 }
 
+FFMS_API(int) FFMS_SetFramePool(int Alignment, int HugePages, FFMS_ErrorInfo *ErrorInfo) {
+    ClearErrorInfo(ErrorInfo);
+    if (Alignment < 0 || Alignment > 4096 || (Alignment & (Alignment - 1)))
+        return FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_INVALID_ARGUMENT,
+            "Frame pool alignment must be 0 or a power of two no larger than 4096").CopyOut(ErrorInfo);
+    SetFramePoolOptions(Alignment, !!HugePages);
+    return FFMS_ERROR_SUCCESS;
+}
+
 FFMS_API(FFMS_VideoSource *) FFMS_CreateVideoSource(const char *SourceFile, int Track, FFMS_Index *Index, int Threads, int SeekMode, FFMS_ErrorInfo *ErrorInfo) {
     try {
         return new FFMS_VideoSource(SourceFile, *Index, Track, Threads, SeekMode);
@@ -429,3 +443,255 @@ FFMS_API(int) FFMS_GetPixFmt(const char *Name) {
 FFMS_API(const char *) FFMS_GetFormatNameI(FFMS_Indexer *Indexer) {
     return Indexer->GetFormatName();
 }
+
+FFMS_API(int) FFMS_SetTensorOutputV(FFMS_VideoSource *V, const FFMS_TensorOptions *Options, FFMS_ErrorInfo *ErrorInfo) {
+    ClearErrorInfo(ErrorInfo);
+    try {
+        V->SetTensorOutput(*Options);
+    } catch (FFMS_Exception &e) {
+        return e.CopyOut(ErrorInfo);
+    }
+    return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(size_t) FFMS_GetTensorSize(FFMS_VideoSource *V) {
+    return V->GetTensorSize();
+}
+
+FFMS_API(int) FFMS_GetFrameTensor(FFMS_VideoSource *V, int n, void *Buf, FFMS_ErrorInfo *ErrorInfo) {
+    ClearErrorInfo(ErrorInfo);
+    try {
+        V->GetFrameTensor(n, Buf);
+    } catch (FFMS_Exception &e) {
+        return e.CopyOut(ErrorInfo);
+    }
+    return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(int) FFMS_GetFrameTensorBatch(FFMS_VideoSource *V, const int *FrameNumbers, int NumFrames, void *Buf, FFMS_ErrorInfo *ErrorInfo) {
+    ClearErrorInfo(ErrorInfo);
+    try {
+        V->GetFrameTensorBatch(FrameNumbers, NumFrames, Buf);
+    } catch (FFMS_Exception &e) {
+        return e.CopyOut(ErrorInfo);
+    }
+    return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(int) FFMS_PlanSampleFrames(FFMS_VideoSource *V, int Count, int Stride, int Policy, int Tolerance, int *FrameNumbers, int MaxFrames, FFMS_ErrorInfo *ErrorInfo) {
+    ClearErrorInfo(ErrorInfo);
+    try {
+        std::vector<int> Plan = V->PlanSampleFrames(Count, Stride, Policy, Tolerance);
+        if (FrameNumbers)
+            std::copy(Plan.begin(), Plan.begin() + (std::min)(static_cast<size_t>((std::max)(MaxFrames, 0)), Plan.size()), FrameNumbers);
+        return static_cast<int>(Plan.size());
+    } catch (FFMS_Exception &e) {
+        e.CopyOut(ErrorInfo);
+        return -1;
+    }
+}
+
+FFMS_API(int) FFMS_SampleFrames(FFMS_VideoSource *V, int Count, int Stride, int Policy, int Tolerance, TFrameSampleCallback SC, void *SCPrivate, FFMS_ErrorInfo *ErrorInfo) {
+    ClearErrorInfo(ErrorInfo);
+    try {
+        V->SampleFrames(Count, Stride, Policy, Tolerance, SC, SCPrivate);
+    } catch (FFMS_Exception &e) {
+        return e.CopyOut(ErrorInfo);
+    }
+    return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(void) FFMS_SetSceneDetectionV(FFMS_VideoSource *V, int Enable) {
+    V->SetSceneDetection(!!Enable);
+}
+
+FFMS_API(int) FFMS_GetSceneScores(FFMS_VideoSource *V, float *Scores, int NumScores) {
+    return V->GetSceneScores(Scores, NumScores);
+}
+
+FFMS_API(int) FFMS_WriteSceneScores(FFMS_VideoSource *V, const char *SceneFile, FFMS_ErrorInfo *ErrorInfo) {
+    ClearErrorInfo(ErrorInfo);
+    try {
+        V->WriteSceneScores(SceneFile);
+    } catch (FFMS_Exception &e) {
+        return e.CopyOut(ErrorInfo);
+    }
+    return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(int) FFMS_ReadSceneScores(FFMS_VideoSource *V, const char *SceneFile, FFMS_ErrorInfo *ErrorInfo) {
+    ClearErrorInfo(ErrorInfo);
+    try {
+        V->ReadSceneScores(SceneFile);
+    } catch (FFMS_Exception &e) {
+        return e.CopyOut(ErrorInfo);
+    }
+    return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(void) FFMS_SetAudioCacheBudget(FFMS_AudioSource *A, int64_t Bytes) {
+    A->SetCacheBudget(static_cast<size_t>(std::max<int64_t>(Bytes, 0)));
+}
+
+FFMS_API(void) FFMS_SetGlobalAudioCacheLimit(int64_t Bytes) {
+    FFMS_AudioSource::SetGlobalCacheLimit(static_cast<size_t>(std::max<int64_t>(Bytes, 0)));
+}
+
+FFMS_API(int) FFMS_GetAudioSpans(FFMS_AudioSource *A, int64_t Start, int64_t Count, FFMS_AudioSpan *Spans, int MaxSpans, int *NumSpans, FFMS_ErrorInfo *ErrorInfo) {
+    ClearErrorInfo(ErrorInfo);
+    *NumSpans = 0;
+    try {
+        *NumSpans = A->GetAudioSpans(Start, Count, Spans, MaxSpans);
+    } catch (FFMS_Exception &e) {
+        return e.CopyOut(ErrorInfo);
+    }
+    return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(void) FFMS_ReleaseAudioSpans(FFMS_AudioSource *A) {
+    A->ReleaseAudioSpans();
+}
+
+FFMS_API(int) FFMS_SetAudioPrefetch(FFMS_AudioSource *A, int64_t Samples, FFMS_ErrorInfo *ErrorInfo) {
+    ClearErrorInfo(ErrorInfo);
+    try {
+        A->SetPrefetch(Samples);
+    } catch (FFMS_Exception &e) {
+        return e.CopyOut(ErrorInfo);
+    }
+    return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(int) FFMS_GetAudioParallel(FFMS_AudioSource *A, void *Buf, int64_t Start, int64_t Count, int Threads, FFMS_ErrorInfo *ErrorInfo) {
+    ClearErrorInfo(ErrorInfo);
+    try {
+        A->GetAudioParallel(Buf, Start, Count, Threads);
+    } catch (FFMS_Exception &e) {
+        return e.CopyOut(ErrorInfo);
+    }
+    return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(int) FFMS_SetAudioSidecar(FFMS_AudioSource *A, const char *SidecarFile, FFMS_ErrorInfo *ErrorInfo) {
+    ClearErrorInfo(ErrorInfo);
+    try {
+        A->SetSidecar(SidecarFile);
+    } catch (FFMS_Exception &e) {
+        return e.CopyOut(ErrorInfo);
+    }
+    return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(void) FFMS_SetAudioPeakIndexing(FFMS_Indexer *Indexer, int BlockSize) {
+    Indexer->SetPeakBlockSize(BlockSize);
+}
+
+FFMS_API(int) FFMS_GetAudioPeakChannels(FFMS_Track *T) {
+    const AudioPeakPyramid &Peaks = T->GetAudioPeaks();
+    return Peaks.empty() ? 0 : Peaks.Channels;
+}
+
+FFMS_API(int) FFMS_GetAudioPeaks(FFMS_Track *T, int64_t Start, int64_t Count, int NumPeaks, FFMS_AudioPeak *Peaks, FFMS_ErrorInfo *ErrorInfo) {
+    ClearErrorInfo(ErrorInfo);
+    try {
+        T->GetAudioPeaks().Query(Start, Count, NumPeaks, Peaks);
+    } catch (FFMS_Exception &e) {
+        return e.CopyOut(ErrorInfo);
+    }
+    return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(int) FFMS_GetSpectrogramBins(const FFMS_SpectrogramOptions *Options) {
+    return GetSpectrogramBins(*Options);
+}
+
+FFMS_API(int) FFMS_GetSpectrogram(FFMS_AudioSource *A, const FFMS_SpectrogramOptions *Options, int64_t Start, int NumFrames, float *Out, FFMS_ErrorInfo *ErrorInfo) {
+    ClearErrorInfo(ErrorInfo);
+    try {
+        A->GetSpectrogram(*Options, &Start, &NumFrames, 1, Out);
+    } catch (FFMS_Exception &e) {
+        return e.CopyOut(ErrorInfo);
+    }
+    return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(int) FFMS_GetSpectrogramBatch(FFMS_AudioSource *A, const FFMS_SpectrogramOptions *Options, const int64_t *Starts, const int *NumFrames, int NumRanges, float *Out, FFMS_ErrorInfo *ErrorInfo) {
+    ClearErrorInfo(ErrorInfo);
+    try {
+        A->GetSpectrogram(*Options, Starts, NumFrames, NumRanges, Out);
+    } catch (FFMS_Exception &e) {
+        return e.CopyOut(ErrorInfo);
+    }
+    return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(int) FFMS_ExtractAudioTracks(const char *SourceFile, FFMS_Index *Index, const int *Tracks, int NumTracks, TAudioSinkCallback Sink, void *SinkPrivate, FFMS_ErrorInfo *ErrorInfo) {
+    ClearErrorInfo(ErrorInfo);
+    try {
+        std::vector<int> TrackList;
+        if (Tracks && NumTracks > 0)
+            TrackList.assign(Tracks, Tracks + NumTracks);
+        ExtractAudioTracks(SourceFile, *Index, TrackList, Sink, SinkPrivate);
+    } catch (FFMS_Exception &e) {
+        return e.CopyOut(ErrorInfo);
+    }
+    return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(int) FFMS_GetAudioRange(FFMS_AudioSource *A, void *Buf, double StartTime, double EndTime, int64_t MaxSamples, int64_t *NumSamples, FFMS_ErrorInfo *ErrorInfo) {
+    ClearErrorInfo(ErrorInfo);
+    try {
+        int64_t Count = A->GetAudioRange(Buf, StartTime, EndTime, MaxSamples);
+        if (NumSamples)
+            *NumSamples = Count;
+    } catch (FFMS_Exception &e) {
+        return e.CopyOut(ErrorInfo);
+    }
+    return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(int) FFMS_GetAudioBatch(FFMS_AudioSource *A, const FFMS_AudioRange *Ranges, int NumRanges, FFMS_ErrorInfo *ErrorInfo) {
+    ClearErrorInfo(ErrorInfo);
+    try {
+        A->GetAudioBatch(Ranges, NumRanges);
+    } catch (FFMS_Exception &e) {
+        return e.CopyOut(ErrorInfo);
+    }
+    return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(int) FFMS_IndexFiles(const char **SourceFiles, const char **IndexFiles, int NumFiles, int IndexAudio, int ErrorHandling, int Threads, TBatchIndexCallback BIC, void *BIPrivate, FFMS_ErrorInfo *ErrorInfo) {
+    ClearErrorInfo(ErrorInfo);
+    try {
+        ::IndexFiles(SourceFiles, IndexFiles, NumFiles, !!IndexAudio, ErrorHandling, Threads, BIC, BIPrivate);
+    } catch (FFMS_Exception &e) {
+        return e.CopyOut(ErrorInfo);
+    }
+    return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(void) FFMS_SetFastAudioIndexing(FFMS_Indexer *Indexer, int Enable) {
+    Indexer->SetFastAudio(!!Enable);
+}
+
+FFMS_API(FFMS_Index *) FFMS_UpdateIndex(FFMS_Indexer *Indexer, FFMS_Index *Existing, int ErrorHandling, FFMS_ErrorInfo *ErrorInfo) {
+    ClearErrorInfo(ErrorInfo);
+
+    FFMS_Index *Index = nullptr;
+    try {
+        Indexer->SetErrorHandling(ErrorHandling);
+        Index = Indexer->UpdateIndex(*Existing);
+    } catch (FFMS_Exception &e) {
+        e.CopyOut(ErrorInfo);
+    }
+    delete Indexer;
+    return Index;
+}
+
+FFMS_API(void) FFMS_SetIndexSnapshotCallback(FFMS_Indexer *Indexer, int Interval, TIndexSnapshotCallback SC, void *SCPrivate) {
+    Indexer->SetSnapshotCallback(Interval, SC, SCPrivate);
+}
+
+FFMS_API(int) FFMS_GetVideoSeekCount(FFMS_VideoSource *V) {
+    return V->GetSeekCount();
+}
@@ -0,0 +1,209 @@
+//  Copyright (c) 2026 The FFmpegSource Project
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "framepool.h"
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+}
+// must be included after ffmpeg headers
+#include "ffmscompat.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <cstdlib>
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+const size_t HugePageSize = 2 * 1024 * 1024;
+const int MinFramePoolAlignment = 16;
+
+struct FramePool {
+    std::mutex Lock;
+    int Alignment = 0;
+    bool HugePages = false;
+    std::map<size_t, AVBufferPool *> Pools;
+
+    ~FramePool() {
+        Clear();
+    }
+
+    // Buffers still in use keep their pool alive until they're returned
+    void Clear() {
+        for (auto &Pool : Pools)
+            av_buffer_pool_uninit(&Pool.second);
+        Pools.clear();
+    }
+};
+
+FramePool &GetFramePool() {
+    static FramePool Pool;
+    return Pool;
+}
+
+void FreeAligned(void *, uint8_t *Data) {
+#ifdef _WIN32
+    _aligned_free(Data);
+#else
+    free(Data);
+#endif
+}
+
+AVBufferRef *AllocAligned(void *Opaque, ffms_buffer_size_t Size) {
+    const FramePool *Pool = static_cast<const FramePool *>(Opaque);
+    size_t Alignment = static_cast<size_t>(Pool->Alignment);
+    bool HugePages = Pool->HugePages && static_cast<size_t>(Size) >= HugePageSize;
+    if (HugePages)
+        Alignment = HugePageSize;
+
+    void *Data = nullptr;
+#ifdef _WIN32
+    Data = _aligned_malloc(Size, Alignment);
+#else
+    if (posix_memalign(&Data, Alignment, Size))
+        Data = nullptr;
+#endif
+    if (!Data)
+        return nullptr;
+
+#if defined(MADV_HUGEPAGE)
+    // Only a hint; the kernel falls back to normal pages if THP is disabled
+    if (HugePages)
+        madvise(Data, Size, MADV_HUGEPAGE);
+#endif
+
+    AVBufferRef *Buffer = av_buffer_create(static_cast<uint8_t *>(Data), Size, FreeAligned, nullptr, 0);
+    if (!Buffer)
+        FreeAligned(nullptr, static_cast<uint8_t *>(Data));
+    return Buffer;
+}
+
+// Sizes are rounded up so that slightly different dimensions share a bucket
+size_t BucketSize(size_t Size) {
+    const size_t Granularity = Size >= HugePageSize ? HugePageSize : 4096;
+    return FFALIGN(Size, Granularity);
+}
+
+AVBufferRef *GetPooledBuffer(FramePool &Pool, size_t Size) {
+    Size = BucketSize(Size);
+    std::lock_guard<std::mutex> Lock(Pool.Lock);
+    AVBufferPool *&BufferPool = Pool.Pools[Size];
+    if (!BufferPool)
+        BufferPool = av_buffer_pool_init2(static_cast<int>(Size), &Pool, AllocAligned, nullptr);
+    return BufferPool ? av_buffer_pool_get(BufferPool) : nullptr;
+}
+
+// Start of the buffer rounded up to the alignment, for which the buffer has
+// to have been allocated Align - 1 bytes larger
+uint8_t *AlignPointer(uint8_t *Data, size_t Align) {
+    return reinterpret_cast<uint8_t *>(FFALIGN(reinterpret_cast<uintptr_t>(Data), Align));
+}
+
+}
+
+void SetFramePoolOptions(int Alignment, bool HugePages) {
+    // posix_memalign requires at least pointer alignment, and SIMD code
+    // expects 16 anyway
+    if (Alignment)
+        Alignment = (std::max)(Alignment, MinFramePoolAlignment);
+
+    FramePool &Pool = GetFramePool();
+    std::lock_guard<std::mutex> Lock(Pool.Lock);
+    if (Alignment == Pool.Alignment && HugePages == Pool.HugePages)
+        return;
+    Pool.Clear();
+    Pool.Alignment = Alignment;
+    Pool.HugePages = HugePages;
+}
+
+int GetFramePoolAlignment() {
+    FramePool &Pool = GetFramePool();
+    std::lock_guard<std::mutex> Lock(Pool.Lock);
+    return Pool.Alignment;
+}
+
+int PooledGetBuffer2(AVCodecContext *Context, AVFrame *Frame, int Flags) {
+    const int Alignment = GetFramePoolAlignment();
+    const AVPixFmtDescriptor *Desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(Frame->format));
+    if (!Alignment || !(Context->codec->capabilities & AV_CODEC_CAP_DR1) || !Desc ||
+        (Desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BITSTREAM)))
+        return avcodec_default_get_buffer2(Context, Frame, Flags);
+
+    // Decoders may write past the visible area up to the aligned dimensions
+    int Width = Frame->width;
+    int Height = Frame->height;
+    int LinesizeAlign[AV_NUM_DATA_POINTERS];
+    avcodec_align_dimensions2(Context, &Width, &Height, LinesizeAlign);
+
+    int Linesize[4];
+    if (av_image_fill_linesizes(Linesize, static_cast<AVPixelFormat>(Frame->format), Width) < 0)
+        return avcodec_default_get_buffer2(Context, Frame, Flags);
+
+    const int Planes = av_pix_fmt_count_planes(static_cast<AVPixelFormat>(Frame->format));
+    for (int i = 0; i < Planes; i++) {
+        int PlaneAlign = (std::max)(Alignment, LinesizeAlign[i]);
+        int PlaneHeight = (i == 1 || i == 2) ? AV_CEIL_RSHIFT(Height, Desc->log2_chroma_h) : Height;
+        Linesize[i] = FFALIGN(Linesize[i], PlaneAlign);
+        // Some SIMD code reads a little past the end of the last line
+        size_t Size = static_cast<size_t>(Linesize[i]) * PlaneHeight + 16 + PlaneAlign - 1;
+
+        Frame->buf[i] = GetPooledBuffer(GetFramePool(), Size);
+        if (!Frame->buf[i]) {
+            for (int j = 0; j < i; j++)
+                av_buffer_unref(&Frame->buf[j]);
+            return AVERROR(ENOMEM);
+        }
+        // Pooled buffers only have the pool's alignment, which may be less
+        // than what the decoder wants for this plane
+        Frame->data[i] = AlignPointer(Frame->buf[i]->data, PlaneAlign);
+        Frame->linesize[i] = Linesize[i];
+    }
+    Frame->extended_data = Frame->data;
+
+    return 0;
+}
+
+AVBufferRef *AllocImageBuffer(uint8_t *Data[4], int Linesize[4], int Width, int Height, AVPixelFormat Format, int DefaultAlign) {
+    const int Alignment = GetFramePoolAlignment();
+    const int Align = Alignment ? Alignment : DefaultAlign;
+
+    int Size = av_image_get_buffer_size(Format, Width, Height, Align);
+    if (Size < 0)
+        return nullptr;
+
+    // Room to align the start, as av_malloc may align less than Align
+    AVBufferRef *Buffer = Alignment ? GetPooledBuffer(GetFramePool(), static_cast<size_t>(Size) + Align - 1) : av_buffer_alloc(Size + Align - 1);
+    if (!Buffer)
+        return nullptr;
+
+    if (av_image_fill_arrays(Data, Linesize, AlignPointer(Buffer->data, Align), Format, Width, Height, Align) < 0) {
+        av_buffer_unref(&Buffer);
+        return nullptr;
+    }
+    return Buffer;
+}
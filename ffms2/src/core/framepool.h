@@ -0,0 +1,47 @@
+//  Copyright (c) 2026 The FFmpegSource Project
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+}
+
+#include <cstddef>
+
+// Process wide pool of aligned buffers used for decoded and converted video
+// frames. Buffers are bucketed by size, so switching back and forth between
+// formats or resolutions keeps recycling the same memory. The pool is
+// disabled (and FFmpeg's own allocation used) while Alignment is 0.
+void SetFramePoolOptions(int Alignment, bool HugePages);
+int GetFramePoolAlignment();
+
+// get_buffer2 implementation which hands out pooled buffers for decoders
+// supporting direct rendering and defers to FFmpeg for everything else
+int PooledGetBuffer2(AVCodecContext *Context, AVFrame *Frame, int Flags);
+
+// Allocates a single buffer for an image and fills in the plane pointers.
+// Uses the pool and its alignment when enabled and av_buffer_alloc with
+// DefaultAlign otherwise.
+AVBufferRef *AllocImageBuffer(uint8_t *Data[4], int Linesize[4], int Width, int Height, AVPixelFormat Format, int DefaultAlign);
+
+#endif
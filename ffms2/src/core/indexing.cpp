@@ -31,11 +31,12 @@
 
 extern "C" {
 #include <libavutil/avutil.h>
+#include <libavutil/intreadwrite.h>
 #include <libavutil/sha.h>
 }
 
 #define INDEXID 0x53920873
-#define INDEX_VERSION 5
+#define INDEX_VERSION 8
 
 SharedAVContext::~SharedAVContext() {
     avcodec_free_context(&CodecContext);
@@ -43,7 +44,7 @@ SharedAVContext::~SharedAVContext() {
         av_parser_close(Parser);
 }
 
-void FFMS_Index::CalculateFileSignature(const char *Filename, int64_t *Filesize, uint8_t Digest[20]) {
+void FFMS_Index::CalculateFileSignature(const char *Filename, int64_t *Filesize, uint8_t Digest[20], int64_t Length) {
     FileHandle file(Filename, "rb", FFMS_ERROR_INDEX, FFMS_ERROR_FILE_READ);
 
     std::unique_ptr<AVSHA, decltype(&av_free)> ctx{ av_sha_alloc(), av_free };
@@ -51,6 +52,8 @@ void FFMS_Index::CalculateFileSignature(const char *Filename, int64_t *Filesize,
 
     try {
         *Filesize = file.Size();
+        if (Length >= 0)
+            *Filesize = std::min(*Filesize, Length);
         std::vector<char> FileBuffer(static_cast<size_t>(std::min<int64_t>(1024 * 1024, *Filesize)));
         size_t BytesRead = file.Read(FileBuffer.data(), FileBuffer.size());
         av_sha_update(ctx.get(), reinterpret_cast<const uint8_t*>(FileBuffer.data()), BytesRead);
@@ -67,6 +70,29 @@ void FFMS_Index::CalculateFileSignature(const char *Filename, int64_t *Filesize,
     av_sha_final(ctx.get(), Digest);
 }
 
+namespace {
+// Bytes per sample for all channels of PCM codecs whose decoders output the
+// stored bytes unchanged, 0 for anything else
+int PCMBlockAlign(const AVCodecContext *Context) {
+    if (!Context)
+        return 0;
+
+    int Bytes;
+    switch (Context->codec_id) {
+    case AV_CODEC_ID_PCM_U8: Bytes = 1; break;
+    case AV_NE(AV_CODEC_ID_PCM_S16BE, AV_CODEC_ID_PCM_S16LE): Bytes = 2; break;
+    case AV_NE(AV_CODEC_ID_PCM_S32BE, AV_CODEC_ID_PCM_S32LE): Bytes = 4; break;
+    case AV_NE(AV_CODEC_ID_PCM_F32BE, AV_CODEC_ID_PCM_F32LE): Bytes = 4; break;
+    case AV_NE(AV_CODEC_ID_PCM_F64BE, AV_CODEC_ID_PCM_F64LE): Bytes = 8; break;
+    default: return 0;
+    }
+
+    if (Context->channels <= 0 || (Context->block_align && Context->block_align != Bytes * Context->channels))
+        return 0;
+    return Bytes * Context->channels;
+}
+}
+
 void FFMS_Index::Finalize(std::vector<SharedAVContext> const& video_contexts, const char *Format) {
     for (size_t i = 0, end = size(); i != end; ++i) {
         FFMS_Track& track = (*this)[i];
@@ -78,6 +104,18 @@ void FFMS_Index::Finalize(std::vector<SharedAVContext> const& video_contexts, co
             track.MaybeHideFrames();
         track.FinalizeTrack();
 
+        if (track.TT == FFMS_TYPE_AUDIO) {
+            // The demuxer needs a few packets to know where it is after a
+            // seek, and all but intra-only codecs need a few more to produce
+            // correct output
+            size_t PreRoll = 10;
+            const AVCodecDescriptor *Desc = video_contexts[i].CodecContext ? avcodec_descriptor_get(video_contexts[i].CodecContext->codec_id) : nullptr;
+            if (!Desc || !(Desc->props & AV_CODEC_PROP_INTRA_ONLY))
+                PreRoll += 15;
+            track.BuildAudioSeekTable(PreRoll);
+            track.DetectPCMLayout(PCMBlockAlign(video_contexts[i].CodecContext));
+        }
+
         if (track.TT != FFMS_TYPE_VIDEO) continue;
 
         if (video_contexts[i].CodecContext && video_contexts[i].CodecContext->has_b_frames) {
@@ -228,6 +266,20 @@ void FFMS_Indexer::SetProgressCallback(TIndexCallback IC_, void *ICPrivate_) {
     ICPrivate = ICPrivate_;
 }
 
+void FFMS_Indexer::SetPeakBlockSize(int BlockSize) {
+    PeakBlockSize = FFMAX(BlockSize, 0);
+}
+
+void FFMS_Indexer::SetFastAudio(bool Enable) {
+    FastAudio = Enable;
+}
+
+void FFMS_Indexer::SetSnapshotCallback(int Interval, TIndexSnapshotCallback SC_, void *SCPrivate_) {
+    SnapshotInterval = FFMAX(Interval, 1);
+    SC = SC_;
+    SCPrivate = SCPrivate_;
+}
+
 FFMS_Indexer *CreateIndexer(const char *Filename) {
     return new FFMS_Indexer(Filename);
 }
@@ -262,7 +314,91 @@ FFMS_Indexer::FFMS_Indexer(const char *Filename)
     }
 }
 
+// Works out how many samples the decoder would output for the packet from
+// the codec's fixed frame size or the packet duration, applying any skip
+// side data the same way the decoder does. Returns false if neither is known.
+bool FFMS_Indexer::GetPacketSampleCount(int Track, AVPacket *Packet, SharedAVContext &Context, uint32_t &Count) {
+    AVStream *Stream = FormatContext->streams[Track];
+    int64_t Duration = av_get_audio_frame_duration2(Stream->codecpar, Packet->size);
+    if (Duration <= 0 && Packet->duration > 0) {
+        // Only usable if it's a whole number of samples
+        int64_t Scaled = Packet->duration * Stream->time_base.num * Stream->codecpar->sample_rate;
+        if (Scaled % Stream->time_base.den == 0)
+            Duration = Scaled / Stream->time_base.den;
+    }
+    if (Duration <= 0)
+        return false;
+
+    int64_t SkipEnd = 0;
+    int SideDataSize = 0;
+    const uint8_t *SkipData = av_packet_get_side_data(Packet, AV_PKT_DATA_SKIP_SAMPLES, &SideDataSize);
+    if (SkipData && SideDataSize >= 10) {
+        Context.PendingSkip += AV_RL32(SkipData);
+        SkipEnd = AV_RL32(SkipData + 4);
+    }
+
+    int64_t Skip = FFMIN(Context.PendingSkip, Duration);
+    Context.PendingSkip -= Skip;
+    Duration = FFMAX(Duration - Skip - SkipEnd, 0);
+
+    // Decoders drop the output of packets marked as discard
+    Count = (Packet->flags & AV_PKT_FLAG_DISCARD) ? 0 : static_cast<uint32_t>(Duration);
+    return true;
+}
+
+// Runs the codec's parser over the packet, which updates the channel count
+// and sample rate from the frame headers of codecs such as AC-3, AAC and MP3.
+// Returns false if they no longer match the last decoded frame.
+bool FFMS_Indexer::ParseAudioPacket(int Track, AVPacket *Packet, SharedAVContext &Context) {
+    if (!Context.Parser)
+        return true;
+
+    uint8_t *OB;
+    int OBSize;
+    av_parser_parse2(Context.Parser, Context.CodecContext,
+        &OB, &OBSize,
+        Packet->data, Packet->size,
+        Packet->pts, Packet->dts, Packet->pos);
+
+    auto it = LastAudioProperties.find(Track);
+    return it == LastAudioProperties.end() ||
+        (it->second.Channels == Context.CodecContext->channels &&
+            it->second.SampleRate == Context.CodecContext->sample_rate);
+}
+
 uint32_t FFMS_Indexer::IndexAudioPacket(int Track, AVPacket *Packet, SharedAVContext &Context, FFMS_Index &TrackIndices) {
+    uint32_t Count;
+    if (Context.FastAudio && Context.FastAudioChecked) {
+        // Decoding from here on reports the change the same way a full
+        // decode would have
+        if (!ParseAudioPacket(Track, Packet, Context)) {
+            Context.FastAudio = false;
+            return DecodeAudioPacket(Track, Packet, Context, TrackIndices);
+        }
+        if (GetPacketSampleCount(Track, Packet, Context, Count)) {
+            Context.CurrentSample += Count;
+            return Count;
+        }
+        // Ambiguous packets are decoded on their own, which gives the right
+        // length for the codecs that get this far even without the packets
+        // before them
+        return DecodeAudioPacket(Track, Packet, Context, TrackIndices);
+    }
+
+    uint32_t Decoded = DecodeAudioPacket(Track, Packet, Context, TrackIndices);
+
+    // Only trust the container if it agrees with the decoder, which also
+    // rules out decoders with delay since they output nothing at first
+    if (Context.FastAudio) {
+        if (!GetPacketSampleCount(Track, Packet, Context, Count) || Count != Decoded)
+            Context.FastAudio = false;
+        else if (Decoded > 0)
+            Context.FastAudioChecked = true;
+    }
+    return Decoded;
+}
+
+uint32_t FFMS_Indexer::DecodeAudioPacket(int Track, AVPacket *Packet, SharedAVContext &Context, FFMS_Index &TrackIndices) {
     AVCodecContext *CodecContext = Context.CodecContext;
     int64_t StartSample = Context.CurrentSample;
     int Ret = avcodec_send_packet(CodecContext, Packet);
@@ -283,6 +419,10 @@ uint32_t FFMS_Indexer::IndexAudioPacket(int Track, AVPacket *Packet, SharedAVCon
         if (Ret == 0) {
             CheckAudioProperties(Track, CodecContext);
             Context.CurrentSample += DecodeFrame->nb_samples;
+
+            auto Peaks = PeakBuilders.find(Track);
+            if (Peaks != PeakBuilders.end())
+                Peaks->second.AddFrame(DecodeFrame);
         } else if (Ret == AVERROR_EOF || Ret == AVERROR(EAGAIN)) {
             break;
         } else {
@@ -389,7 +529,57 @@ const char *FFMS_Indexer::GetTrackCodec(int Track) {
     return codec ? codec->name : nullptr;
 }
 
-FFMS_Index *FFMS_Indexer::DoIndexing() {
+// Finalizes a copy of what's been indexed so far. Video tracks are cut at
+// their last keyframe, since the frames after it may still be waiting for
+// the rest of their GOP, while every audio packet indexed is complete.
+void FFMS_Indexer::PublishSnapshot(const FFMS_Index &TrackIndices, std::vector<SharedAVContext> const& AVContexts) {
+    auto Snapshot = make_unique<FFMS_Index>(Filesize, Digest, ErrorHandling);
+    for (auto const& Track : TrackIndices) {
+        size_t Count = Track.size();
+        if (Track.TT == FFMS_TYPE_VIDEO) {
+            while (Count > 0 && !Track[Count - 1].KeyFrame)
+                --Count;
+            if (Count > 0)
+                --Count;
+        }
+        Snapshot->push_back(Track.Snapshot(Count));
+    }
+    Snapshot->Finalize(AVContexts, FormatContext->iformat->name);
+
+    if ((*SC)(Snapshot.release(), SCPrivate))
+        throw FFMS_Exception(FFMS_ERROR_CANCELLED, FFMS_ERROR_USER,
+            "Cancelled by user");
+}
+
+bool FFMS_Indexer::CanResume(const FFMS_Index &Existing) {
+    // Peaks can't be continued without the samples before
+    if (PeakBlockSize > 0 || Existing.size() != FormatContext->nb_streams || Filesize < Existing.Filesize)
+        return false;
+
+    int64_t PrefixSize;
+    uint8_t PrefixDigest[20];
+    FFMS_Index::CalculateFileSignature(SourceFile.c_str(), &PrefixSize, PrefixDigest, Existing.Filesize);
+    if (PrefixSize != Existing.Filesize || memcmp(PrefixDigest, Existing.Digest, sizeof(PrefixDigest)))
+        return false;
+
+    // The same tracks have to be indexed, and resuming finds its place by
+    // the file positions of the last packets
+    for (unsigned int i = 0; i < FormatContext->nb_streams; i++) {
+        const FFMS_Track &Track = Existing[i];
+        bool Indexed = IndexMask.count(i) && !(FormatContext->streams[i]->disposition & AV_DISPOSITION_ATTACHED_PIC);
+        if (Indexed != !Track.empty() || Track.TT != static_cast<FFMS_TrackType>(FormatContext->streams[i]->codecpar->codec_type))
+            return false;
+        if (Indexed && (Track.back().FilePos < 0 || !Track.GetAudioPeaks().empty()))
+            return false;
+    }
+    return true;
+}
+
+FFMS_Index *FFMS_Indexer::UpdateIndex(const FFMS_Index &Existing) {
+    return DoIndexing(CanResume(Existing) ? &Existing : nullptr);
+}
+
+FFMS_Index *FFMS_Indexer::DoIndexing(const FFMS_Index *Existing) {
     std::vector<SharedAVContext> AVContexts(FormatContext->nb_streams);
 
     auto TrackIndices = make_unique<FFMS_Index>(Filesize, Digest, ErrorHandling);
@@ -453,6 +643,18 @@ FFMS_Index *FFMS_Indexer::DoIndexing() {
                     "Could not open audio codec");
 
             (*TrackIndices)[i].HasTS = false;
+
+            if (PeakBlockSize > 0)
+                PeakBuilders.emplace(i, AudioPeakBuilder(PeakBlockSize));
+            // Peaks need the decoded samples, and otherwise plain PCM never
+            // needs decoding to count its samples
+            else
+                AVContexts[i].FastAudio = FastAudio || PCMBlockAlign(AVContexts[i].CodecContext) > 0;
+
+            // The parser reads the frame headers to catch format changes
+            // when the packets aren't decoded
+            if (AVContexts[i].FastAudio)
+                AVContexts[i].Parser = av_parser_init(FormatContext->streams[i]->codecpar->codec_id);
         } else {
             FormatContext->streams[i]->discard = AVDISCARD_ALL;
             IndexMask.erase(i);
@@ -463,7 +665,47 @@ FFMS_Index *FFMS_Indexer::DoIndexing() {
     InitNullPacket(Packet);
     std::vector<int64_t> LastValidTS(FormatContext->nb_streams, AV_NOPTS_VALUE);
 
+    // Position of the first packet to read again in each track, the number
+    // of packets from there which are only decoded to warm the decoder up,
+    // and whether the demuxer has got there
+    std::vector<int64_t> ResumePos(FormatContext->nb_streams, -1);
+    std::vector<size_t> Warmup(FormatContext->nb_streams, 0);
+    std::vector<bool> Resumed(FormatContext->nb_streams, true);
+    if (Existing) {
+        // The last packets may have been cut short by the end of what had
+        // been written at the time, and neither the decoder nor the parser
+        // state at the end can be recreated, so indexing continues from a
+        // keyframe or audio seek point a bit before the end
+        const size_t ResumeMargin = 16;
+        int64_t SeekPos = -1;
+        bool FromStart = false;
+        for (int i : IndexMask) {
+            int64_t RestartPos;
+            size_t Keep = (*Existing)[i].ResumePoint(ResumeMargin, RestartPos, Warmup[i]);
+            FFMS_Track &TrackInfo = (*TrackIndices)[i] = (*Existing)[i].Unfinalized(Keep);
+            if (TrackInfo.empty()) {
+                FromStart = true;
+                continue;
+            }
+            if (TrackInfo.TT == FFMS_TYPE_AUDIO)
+                AVContexts[i].CurrentSample = TrackInfo.back().SampleStart + TrackInfo.back().SampleCount;
+            LastValidTS[i] = TrackInfo.back().PTS;
+            ResumePos[i] = RestartPos;
+            Resumed[i] = false;
+            SeekPos = SeekPos < 0 ? ResumePos[i] : FFMIN(SeekPos, ResumePos[i]);
+        }
+
+        // Demuxers which can't seek by byte just read from the start with
+        // the already indexed packets skipped below
+        if (SeekPos >= 0 && !FromStart)
+            av_seek_frame(FormatContext, -1, SeekPos, AVSEEK_FLAG_BYTE);
+    }
+
     int64_t filesize = avio_size(FormatContext->pb);
+    // Each snapshot copies and finalizes everything indexed so far, so the
+    // gap between them doubles every time to keep the total work linear
+    int64_t PacketsSinceSnapshot = 0;
+    int64_t NextSnapshotInterval = SnapshotInterval;
     enum AVPictureStructure LastPicStruct = AV_PICTURE_STRUCTURE_UNKNOWN;
     while (av_read_frame(FormatContext, &Packet) >= 0) {
         // Update progress
@@ -479,6 +721,25 @@ FFMS_Index *FFMS_Indexer::DoIndexing() {
         }
 
         int Track = Packet.stream_index;
+        if (!Resumed[Track]) {
+            if (Packet.pos < 0 || Packet.pos < ResumePos[Track]) {
+                av_packet_unref(&Packet);
+                continue;
+            }
+            Resumed[Track] = true;
+        }
+
+        // Already indexed packets before the resume point only go through
+        // the decoder, so it's in the same state as when indexing in one go
+        if (Warmup[Track] > 0) {
+            --Warmup[Track];
+            int64_t CurrentSample = AVContexts[Track].CurrentSample;
+            DecodeAudioPacket(Track, &Packet, AVContexts[Track], *TrackIndices);
+            AVContexts[Track].CurrentSample = CurrentSample;
+            av_packet_unref(&Packet);
+            continue;
+        }
+
         FFMS_Track &TrackInfo = (*TrackIndices)[Track];
         bool KeyFrame = !!(Packet.flags & AV_PKT_FLAG_KEY);
         ReadTS(Packet, LastValidTS[Track], (*TrackIndices)[Track].UseDTS);
@@ -534,7 +795,22 @@ FFMS_Index *FFMS_Indexer::DoIndexing() {
             TrackInfo.LastDuration = Packet.duration;
 
         av_packet_unref(&Packet);
+
+        if (SC && ++PacketsSinceSnapshot >= NextSnapshotInterval) {
+            PacketsSinceSnapshot = 0;
+            NextSnapshotInterval *= 2;
+            PublishSnapshot(*TrackIndices, AVContexts);
+        }
+    }
+
+    // Peak positions are those of the decoded samples, which only differ from
+    // the track's if finalizing fills gaps between packets with silence
+    for (auto &Peaks : PeakBuilders) {
+        FFMS_Track &TrackInfo = (*TrackIndices)[Peaks.first];
+        if (!TrackInfo.empty())
+            TrackInfo.SetAudioPeaks(Peaks.second.Finish());
     }
+    PeakBuilders.clear();
 
     TrackIndices->Finalize(AVContexts, FormatContext->iformat->name);
     return TrackIndices.release();
@@ -22,6 +22,7 @@
 #define INDEXING_H
 
 #include "utils.h"
+#include "peaks.h"
 
 #include <set>
 #include <map>
@@ -39,6 +40,12 @@ struct SharedAVContext {
     AVCodecContext *CodecContext = nullptr;
     AVCodecParserContext *Parser = nullptr;
     int64_t CurrentSample = 0;
+    // Audio sample counts are taken from the container instead of decoding
+    // once the first packet has been checked against the decoder output
+    bool FastAudio = false;
+    bool FastAudioChecked = false;
+    // Samples still to be dropped from the start of the following packets
+    int64_t PendingSkip = 0;
     ~SharedAVContext();
 };
 
@@ -48,7 +55,10 @@ struct FFMS_Index : public std::vector<FFMS_Track> {
     void ReadIndex(ZipFile &zf, const char* IndexFile);
     void WriteIndex(ZipFile &zf);
 public:
-    static void CalculateFileSignature(const char *Filename, int64_t *Filesize, uint8_t Digest[20]);
+    // Signature of the file as if it were only Length bytes long, if it's
+    // longer than that, so that an index of a file which has been appended
+    // to can be checked against what it was made from
+    static void CalculateFileSignature(const char *Filename, int64_t *Filesize, uint8_t Digest[20], int64_t Length = -1);
 
     int ErrorHandling;
     int64_t Filesize;
@@ -76,6 +86,15 @@ private:
     void *ICPrivate = nullptr;
     std::string SourceFile;
     AVFrame *DecodeFrame = nullptr;
+    // Samples per peak in the audio peak pyramids, 0 to not compute them
+    int PeakBlockSize = 0;
+    std::map<int, AudioPeakBuilder> PeakBuilders;
+    bool FastAudio = false;
+    // Snapshots of the index are handed out after SnapshotInterval packets
+    // and then after twice as many packets as the previous gap
+    TIndexSnapshotCallback SC = nullptr;
+    void *SCPrivate = nullptr;
+    int SnapshotInterval = 0;
 
     int64_t Filesize;
     uint8_t Digest[20];
@@ -83,6 +102,11 @@ private:
     void ReadTS(const AVPacket &Packet, int64_t &TS, bool &UseDTS);
     void CheckAudioProperties(int Track, AVCodecContext *Context);
     uint32_t IndexAudioPacket(int Track, AVPacket *Packet, SharedAVContext &Context, FFMS_Index &TrackIndices);
+    uint32_t DecodeAudioPacket(int Track, AVPacket *Packet, SharedAVContext &Context, FFMS_Index &TrackIndices);
+    bool GetPacketSampleCount(int Track, AVPacket *Packet, SharedAVContext &Context, uint32_t &Count);
+    bool ParseAudioPacket(int Track, AVPacket *Packet, SharedAVContext &Context);
+    bool CanResume(const FFMS_Index &Existing);
+    void PublishSnapshot(const FFMS_Index &TrackIndices, std::vector<SharedAVContext> const& AVContexts);
     void ParseVideoPacket(SharedAVContext &VideoContext, AVPacket &pkt, int *RepeatPict, int *FrameType, bool *Invisible, enum AVPictureStructure *LastPicStruct);
     void Free();
 public:
@@ -93,8 +117,16 @@ public:
     void SetIndexTrackType(int TrackType, bool Index);
     void SetErrorHandling(int ErrorHandling_);
     void SetProgressCallback(TIndexCallback IC_, void *ICPrivate_);
-
-    FFMS_Index *DoIndexing();
+    void SetPeakBlockSize(int BlockSize);
+    void SetFastAudio(bool Enable);
+    void SetSnapshotCallback(int Interval, TIndexSnapshotCallback SC_, void *SCPrivate_);
+
+    // With Existing the demuxer is moved back to a point shortly before the
+    // end of what it has, and indexing continues from there on copies of
+    // its tracks cut off at that point
+    FFMS_Index *DoIndexing(const FFMS_Index *Existing = nullptr);
+    // Index of the file reusing an index of its beginning where possible
+    FFMS_Index *UpdateIndex(const FFMS_Index &Existing);
     int GetNumberOfTracks();
     FFMS_TrackType GetTrackType(int Track);
     const char *GetTrackCodec(int Track);
@@ -0,0 +1,178 @@
+//  Copyright (c) 2026 The FFmpegSource Project
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "mappedfile.h"
+
+#include "utils.h"
+
+#ifdef _WIN32
+#	define WIN32_LEAN_AND_MEAN
+#	include <windows.h>
+#else
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
+
+#ifdef _WIN32
+namespace {
+    std::wstring WidenPath(const char *Filename) {
+        int Length = MultiByteToWideChar(CP_UTF8, 0, Filename, -1, nullptr, 0);
+        std::wstring Wide(Length > 0 ? Length : 1, L'\0');
+        if (Length > 0)
+            MultiByteToWideChar(CP_UTF8, 0, Filename, -1, &Wide[0], Length);
+        return Wide;
+    }
+}
+#endif
+
+MappedFile::MappedFile(const char *Filename, int ErrorSource)
+    : Filename(Filename) {
+#ifdef _WIN32
+    HANDLE Handle = CreateFileW(WidenPath(Filename).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (Handle == INVALID_HANDLE_VALUE)
+        throw FFMS_Exception(ErrorSource, FFMS_ERROR_NO_FILE,
+            "Failed to open '" + this->Filename + "'");
+    File = Handle;
+
+    LARGE_INTEGER FileSize;
+    if (!GetFileSizeEx(Handle, &FileSize)) {
+        Close();
+        throw FFMS_Exception(ErrorSource, FFMS_ERROR_FILE_READ,
+            "Failed to read the size of '" + this->Filename + "'");
+    }
+    Size = static_cast<size_t>(FileSize.QuadPart);
+#else
+    File = open(Filename, O_RDONLY);
+    if (File < 0)
+        throw FFMS_Exception(ErrorSource, FFMS_ERROR_NO_FILE,
+            "Failed to open '" + this->Filename + "'");
+
+    struct stat Stat;
+    if (fstat(File, &Stat)) {
+        Close();
+        throw FFMS_Exception(ErrorSource, FFMS_ERROR_FILE_READ,
+            "Failed to read the size of '" + this->Filename + "'");
+    }
+    Size = static_cast<size_t>(Stat.st_size);
+#endif
+    Map(ErrorSource);
+}
+
+MappedFile::MappedFile(const char *Filename, size_t Size, int ErrorSource)
+    : Filename(Filename), Size(Size), Writable(true) {
+#ifdef _WIN32
+    HANDLE Handle = CreateFileW(WidenPath(Filename).c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (Handle == INVALID_HANDLE_VALUE)
+        throw FFMS_Exception(ErrorSource, FFMS_ERROR_FILE_WRITE,
+            "Failed to create '" + this->Filename + "'");
+    File = Handle;
+#else
+    File = open(Filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (File < 0)
+        throw FFMS_Exception(ErrorSource, FFMS_ERROR_FILE_WRITE,
+            "Failed to create '" + this->Filename + "'");
+#endif
+    Reserve(ErrorSource);
+    Map(ErrorSource);
+}
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+void MappedFile::Reserve(int ErrorSource) {
+    // Running out of space while writing through a mapping can't be
+    // reported as an error (it's SIGBUS on POSIX systems), so all of the
+    // space is allocated up front rather than leaving a sparse file
+#ifdef _WIN32
+    LARGE_INTEGER End;
+    End.QuadPart = static_cast<LONGLONG>(Size);
+    bool Failed = !SetFilePointerEx(File, End, nullptr, FILE_BEGIN) || !SetEndOfFile(File);
+#elif defined(__APPLE__)
+    fstore_t Store = { F_ALLOCATEALL, F_PEOFPOSMODE, 0, static_cast<off_t>(Size), 0 };
+    bool Failed = (Size && fcntl(File, F_PREALLOCATE, &Store) == -1) || ftruncate(File, static_cast<off_t>(Size));
+#else
+    bool Failed = Size && posix_fallocate(File, 0, static_cast<off_t>(Size));
+#endif
+    if (Failed) {
+        Close();
+        throw FFMS_Exception(ErrorSource, FFMS_ERROR_FILE_WRITE,
+            "Not enough space to create '" + Filename + "'");
+    }
+}
+
+void MappedFile::Map(int ErrorSource) {
+    // Mapping zero bytes isn't allowed, and there's nothing to map anyway
+    if (!Size)
+        return;
+
+#ifdef _WIN32
+    DWORD Protect = Writable ? PAGE_READWRITE : PAGE_READONLY;
+    Mapping = CreateFileMappingW(File, nullptr, Protect,
+        static_cast<DWORD>(static_cast<uint64_t>(Size) >> 32), static_cast<DWORD>(Size), nullptr);
+    if (Mapping)
+        Data = static_cast<uint8_t *>(MapViewOfFile(Mapping, Writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, Size));
+#else
+    void *Address = mmap(nullptr, Size, Writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, File, 0);
+    if (Address != MAP_FAILED)
+        Data = static_cast<uint8_t *>(Address);
+#endif
+
+    if (!Data) {
+        Close();
+        throw FFMS_Exception(ErrorSource, FFMS_ERROR_ALLOCATION_FAILED,
+            "Failed to map '" + Filename + "' into memory");
+    }
+}
+
+void MappedFile::Flush(int ErrorSource) {
+    if (!Data || !Writable)
+        return;
+#ifdef _WIN32
+    bool Failed = !FlushViewOfFile(Data, Size);
+#else
+    bool Failed = !!msync(Data, Size, MS_SYNC);
+#endif
+    if (Failed)
+        throw FFMS_Exception(ErrorSource, FFMS_ERROR_FILE_WRITE,
+            "Failed to write to '" + Filename + "'");
+}
+
+void MappedFile::Close() {
+#ifdef _WIN32
+    if (Data)
+        UnmapViewOfFile(Data);
+    if (Mapping)
+        CloseHandle(Mapping);
+    if (File)
+        CloseHandle(File);
+    Mapping = nullptr;
+    File = nullptr;
+#else
+    if (Data)
+        munmap(Data, Size);
+    if (File >= 0)
+        close(File);
+    File = -1;
+#endif
+    Data = nullptr;
+}
@@ -0,0 +1,64 @@
+//  Copyright (c) 2026 The FFmpegSource Project
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// A file mapped into memory in its entirety. Existing files are mapped
+// read-only, while new ones are created at the given size with all of
+// their space allocated, and mapped writable so they can be filled in
+// place. Errors are reported as exceptions of the given type.
+class MappedFile {
+    std::string Filename;
+    uint8_t *Data = nullptr;
+    size_t Size = 0;
+    bool Writable = false;
+#ifdef _WIN32
+    void *File = nullptr;
+    void *Mapping = nullptr;
+#else
+    int File = -1;
+#endif
+
+    void Reserve(int ErrorSource);
+    void Map(int ErrorSource);
+    void Close();
+
+public:
+    // Map an existing file
+    MappedFile(const char *Filename, int ErrorSource);
+    // Create or truncate a file of Size bytes
+    MappedFile(const char *Filename, size_t Size, int ErrorSource);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    uint8_t *GetData() const { return Data; }
+    size_t GetSize() const { return Size; }
+    // Write changes to a writable mapping back to the file
+    void Flush(int ErrorSource);
+};
+
+#endif
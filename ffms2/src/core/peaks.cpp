@@ -0,0 +1,205 @@
+//  Copyright (c) 2026 The FFmpegSource Project
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "peaks.h"
+
+#include "utils.h"
+#include "zipfile.h"
+
+extern "C" {
+#include <libavutil/samplefmt.h>
+}
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+    AudioPeakPyramid::Entry EmptyEntry() {
+        return { std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest(), 0.f };
+    }
+
+    void Merge(AudioPeakPyramid::Entry &Dst, AudioPeakPyramid::Entry const& Src) {
+        Dst.Min = std::min(Dst.Min, Src.Min);
+        Dst.Max = std::max(Dst.Max, Src.Max);
+    }
+}
+
+AudioPeakBuilder::AudioPeakBuilder(int BlockSize) {
+    Pyramid.BlockSize = BlockSize;
+}
+
+template<typename T>
+void AudioPeakBuilder::AddSamples(const AVFrame *Frame, double Offset, double Scale) {
+    const bool Planar = !!av_sample_fmt_is_planar(static_cast<AVSampleFormat>(Frame->format));
+    const int Channels = Pyramid.Channels;
+    for (int s = 0; s < Frame->nb_samples; s++) {
+        for (int c = 0; c < Channels; c++) {
+            T Raw = Planar
+                ? reinterpret_cast<const T *>(Frame->extended_data[c])[s]
+                : reinterpret_cast<const T *>(Frame->extended_data[0])[s * Channels + c];
+            float Value = static_cast<float>((Raw - Offset) * Scale);
+            Block[c].Min = std::min(Block[c].Min, Value);
+            Block[c].Max = std::max(Block[c].Max, Value);
+            SumSquares[c] += Value * Value;
+        }
+        if (++BlockSamples == Pyramid.BlockSize)
+            FinishBlock();
+    }
+}
+
+void AudioPeakBuilder::AddFrame(const AVFrame *Frame) {
+    if (!Pyramid.Channels) {
+        Pyramid.Channels = Frame->channels;
+        Block.assign(Pyramid.Channels, EmptyEntry());
+        SumSquares.assign(Pyramid.Channels, 0);
+    }
+
+    // The indexer rejects format changes, so this only guards against
+    // decoders that report them inconsistently
+    if (Frame->channels != Pyramid.Channels)
+        return;
+
+    switch (av_get_packed_sample_fmt(static_cast<AVSampleFormat>(Frame->format))) {
+    case AV_SAMPLE_FMT_U8:  AddSamples<uint8_t>(Frame, 128, 1. / 128); break;
+    case AV_SAMPLE_FMT_S16: AddSamples<int16_t>(Frame, 0, 1. / 32768); break;
+    case AV_SAMPLE_FMT_S32: AddSamples<int32_t>(Frame, 0, 1. / 2147483648.); break;
+    case AV_SAMPLE_FMT_S64: AddSamples<int64_t>(Frame, 0, 1. / 9223372036854775808.); break;
+    case AV_SAMPLE_FMT_FLT: AddSamples<float>(Frame, 0, 1); break;
+    case AV_SAMPLE_FMT_DBL: AddSamples<double>(Frame, 0, 1); break;
+    default: return;
+    }
+    Pyramid.NumSamples += Frame->nb_samples;
+}
+
+void AudioPeakBuilder::FinishBlock() {
+    if (Pyramid.Levels.empty())
+        Pyramid.Levels.resize(1);
+    auto &Level = Pyramid.Levels[0];
+    for (int c = 0; c < Pyramid.Channels; c++) {
+        Block[c].MeanSquare = static_cast<float>(SumSquares[c] / BlockSamples);
+        Level.push_back(Block[c]);
+        Block[c] = EmptyEntry();
+        SumSquares[c] = 0;
+    }
+    BlockSamples = 0;
+}
+
+AudioPeakPyramid AudioPeakBuilder::Finish() {
+    if (BlockSamples)
+        FinishBlock();
+    Pyramid.BuildLevels();
+    return std::move(Pyramid);
+}
+
+void AudioPeakPyramid::BuildLevels() {
+    if (Levels.empty())
+        return;
+    Levels.resize(1);
+
+    // The last entry of a level may cover fewer samples than the others, but
+    // it's weighted the same since it makes no visible difference
+    while (Levels.back().size() > static_cast<size_t>(Channels)) {
+        std::vector<Entry> const& Prev = Levels.back();
+        size_t Entries = Prev.size() / Channels;
+        std::vector<Entry> Next;
+        Next.reserve((Entries + 1) / 2 * Channels);
+        for (size_t i = 0; i < Entries; i += 2) {
+            for (int c = 0; c < Channels; c++) {
+                Entry e = Prev[i * Channels + c];
+                if (i + 1 < Entries) {
+                    Entry const& Other = Prev[(i + 1) * Channels + c];
+                    Merge(e, Other);
+                    e.MeanSquare = (e.MeanSquare + Other.MeanSquare) / 2;
+                }
+                Next.push_back(e);
+            }
+        }
+        Levels.push_back(std::move(Next));
+    }
+}
+
+void AudioPeakPyramid::Query(int64_t Start, int64_t Count, int NumPeaks, FFMS_AudioPeak *Peaks) const {
+    if (Start < 0 || Count <= 0 || NumPeaks <= 0)
+        throw FFMS_Exception(FFMS_ERROR_TRACK, FFMS_ERROR_INVALID_ARGUMENT,
+            "Invalid audio peak range requested");
+    if (empty())
+        throw FFMS_Exception(FFMS_ERROR_TRACK, FFMS_ERROR_NOT_AVAILABLE,
+            "No audio peaks were computed for this track");
+
+    // Use the coarsest level which still has at least one entry per peak
+    size_t Level = 0;
+    const int64_t SamplesPerPeak = std::max<int64_t>(Count / NumPeaks, 1);
+    while (Level + 1 < Levels.size() && (static_cast<int64_t>(BlockSize) << (Level + 1)) <= SamplesPerPeak)
+        ++Level;
+    const int64_t EntrySamples = static_cast<int64_t>(BlockSize) << Level;
+    std::vector<Entry> const& Entries = Levels[Level];
+    const int64_t NumEntries = static_cast<int64_t>(Entries.size() / Channels);
+
+    for (int p = 0; p < NumPeaks; p++) {
+        // Every peak covers at least one entry so that zooming in far
+        // enough repeats entries rather than leaving gaps
+        int64_t First = (Start + Count * p / NumPeaks) / EntrySamples;
+        int64_t Last = std::max((Start + Count * (p + 1) / NumPeaks + EntrySamples - 1) / EntrySamples, First + 1);
+        Last = std::min(Last, NumEntries);
+
+        for (int c = 0; c < Channels; c++) {
+            FFMS_AudioPeak &Peak = Peaks[p * Channels + c];
+            if (First >= Last) {
+                // Past the end of the audio
+                Peak = { 0.f, 0.f, 0.f };
+                continue;
+            }
+
+            Entry e = EmptyEntry();
+            double MeanSquare = 0;
+            for (int64_t i = First; i < Last; i++) {
+                Merge(e, Entries[i * Channels + c]);
+                MeanSquare += Entries[i * Channels + c].MeanSquare;
+            }
+            Peak.Min = e.Min;
+            Peak.Max = e.Max;
+            Peak.RMS = static_cast<float>(std::sqrt(MeanSquare / (Last - First)));
+        }
+    }
+}
+
+// Only the first level is stored as the others are quick to rebuild from it
+void AudioPeakPyramid::Write(ZipFile &Stream) const {
+    Stream.Write<int32_t>(BlockSize);
+    Stream.Write<int32_t>(Channels);
+    Stream.Write<int64_t>(NumSamples);
+    Stream.Write<uint64_t>(empty() ? 0 : Levels[0].size());
+    if (!empty() && !Levels[0].empty())
+        Stream.Write(Levels[0].data(), Levels[0].size() * sizeof(Entry));
+}
+
+void AudioPeakPyramid::Read(ZipFile &Stream) {
+    BlockSize = Stream.Read<int32_t>();
+    Channels = Stream.Read<int32_t>();
+    NumSamples = Stream.Read<int64_t>();
+    Levels.clear();
+    size_t Entries = static_cast<size_t>(Stream.Read<uint64_t>());
+    if (!Entries)
+        return;
+    Levels.emplace_back(Entries);
+    Stream.Read(Levels[0].data(), Entries * sizeof(Entry));
+    BuildLevels();
+}
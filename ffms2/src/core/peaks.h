@@ -0,0 +1,77 @@
+//  Copyright (c) 2026 The FFmpegSource Project
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#ifndef PEAKS_H
+#define PEAKS_H
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+#include "ffms.h"
+
+#include <vector>
+
+class ZipFile;
+
+// Min, max and RMS of the samples of an audio track at a range of
+// resolutions. Level 0 has an entry per BlockSize samples and each level
+// after it combines two entries of the one before, down to a single entry.
+// Entries are stored interleaved by channel.
+struct AudioPeakPyramid {
+    struct Entry {
+        float Min;
+        float Max;
+        float MeanSquare;
+    };
+
+    int BlockSize = 0;
+    int Channels = 0;
+    int64_t NumSamples = 0;
+    std::vector<std::vector<Entry>> Levels;
+
+    bool empty() const { return Levels.empty(); }
+    // Fill Peaks with NumPeaks * Channels peaks evenly covering Count samples
+    // starting at Start
+    void Query(int64_t Start, int64_t Count, int NumPeaks, FFMS_AudioPeak *Peaks) const;
+
+    void BuildLevels();
+    void Write(ZipFile &Stream) const;
+    void Read(ZipFile &Stream);
+};
+
+// Accumulates level 0 of the pyramid from decoded frames
+class AudioPeakBuilder {
+    AudioPeakPyramid Pyramid;
+    std::vector<AudioPeakPyramid::Entry> Block;
+    std::vector<double> SumSquares;
+    int BlockSamples = 0;
+
+    void FinishBlock();
+    template<typename T>
+    void AddSamples(const AVFrame *Frame, double Offset, double Scale);
+
+public:
+    explicit AudioPeakBuilder(int BlockSize);
+    void AddFrame(const AVFrame *Frame);
+    AudioPeakPyramid Finish();
+};
+
+#endif
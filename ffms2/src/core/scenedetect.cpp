@@ -0,0 +1,134 @@
+//  Copyright (c) 2026 The FFmpegSource Project
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "scenedetect.h"
+#include "simd.h"
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+
+const int MaxThumbWidth = 64;
+const int MaxThumbHeight = 36;
+
+uint32_t SumBytes(const uint8_t *Src, int Count) {
+    uint32_t Sum = 0;
+    int i = 0;
+#ifdef FFMS_SSE2
+    const __m128i Zero = _mm_setzero_si128();
+    __m128i Acc = Zero;
+    for (; i + 16 <= Count; i += 16)
+        Acc = _mm_add_epi64(Acc, _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(Src + i)), Zero));
+    Sum = static_cast<uint32_t>(_mm_cvtsi128_si32(Acc) + _mm_cvtsi128_si32(_mm_srli_si128(Acc, 8)));
+#endif
+    for (; i < Count; i++)
+        Sum += Src[i];
+    return Sum;
+}
+
+uint32_t AbsDiffBytes(const uint8_t *A, const uint8_t *B, size_t Count) {
+    uint32_t Sum = 0;
+    size_t i = 0;
+#ifdef FFMS_SSE2
+    __m128i Acc = _mm_setzero_si128();
+    for (; i + 16 <= Count; i += 16)
+        Acc = _mm_add_epi64(Acc, _mm_sad_epu8(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(A + i)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(B + i))));
+    Sum = static_cast<uint32_t>(_mm_cvtsi128_si32(Acc) + _mm_cvtsi128_si32(_mm_srli_si128(Acc, 8)));
+#endif
+    for (; i < Count; i++)
+        Sum += static_cast<uint32_t>(std::abs(A[i] - B[i]));
+    return Sum;
+}
+
+}
+
+bool ComputeLumaThumbnail(const AVFrame *Frame, std::vector<uint8_t> &Thumb) {
+    const AVPixFmtDescriptor *Desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(Frame->format));
+    if (!Desc || Desc->nb_components < 1 || Desc->comp[0].plane != 0 || !Frame->data[0] ||
+        (Desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_BE)))
+        return false;
+
+    const int Depth = Desc->comp[0].depth;
+    const int Step = Desc->comp[0].step;
+    const int Offset = Desc->comp[0].offset;
+    const bool HighBitDepth = Depth > 8;
+    if (HighBitDepth ? (Step != 2 || Offset != 0 || Depth > 16) : Depth != 8)
+        return false;
+
+    const int Width = Frame->width;
+    const int Height = Frame->height;
+    if (Width <= 0 || Height <= 0)
+        return false;
+
+    const int ThumbWidth = std::min(MaxThumbWidth, Width);
+    const int ThumbHeight = std::min(MaxThumbHeight, Height);
+
+    int XBounds[MaxThumbWidth + 1];
+    for (int x = 0; x <= ThumbWidth; x++)
+        XBounds[x] = x * Width / ThumbWidth;
+
+    std::vector<uint32_t> Sums(ThumbWidth * ThumbHeight);
+    std::vector<uint32_t> RowCounts(ThumbHeight);
+    for (int y = 0; y < Height; y++) {
+        const uint8_t *Row = Frame->data[0] + static_cast<ptrdiff_t>(y) * Frame->linesize[0] + Offset;
+        const int ThumbY = y * ThumbHeight / Height;
+        uint32_t *RowSums = &Sums[ThumbY * ThumbWidth];
+        RowCounts[ThumbY]++;
+        for (int x = 0; x < ThumbWidth; x++) {
+            uint32_t Sum = 0;
+            if (HighBitDepth) {
+                const uint16_t *Src = reinterpret_cast<const uint16_t *>(Row);
+                for (int i = XBounds[x]; i < XBounds[x + 1]; i++)
+                    Sum += Src[i] >> (Depth - 8);
+            } else if (Step == 1) {
+                Sum = SumBytes(Row + XBounds[x], XBounds[x + 1] - XBounds[x]);
+            } else {
+                for (int i = XBounds[x]; i < XBounds[x + 1]; i++)
+                    Sum += Row[i * Step];
+            }
+            RowSums[x] += Sum;
+        }
+    }
+
+    Thumb.resize(Sums.size() + 2);
+    Thumb[0] = static_cast<uint8_t>(ThumbWidth);
+    Thumb[1] = static_cast<uint8_t>(ThumbHeight);
+    for (int y = 0; y < ThumbHeight; y++) {
+        for (int x = 0; x < ThumbWidth; x++) {
+            uint32_t Count = RowCounts[y] * static_cast<uint32_t>(XBounds[x + 1] - XBounds[x]);
+            Thumb[2 + y * ThumbWidth + x] = static_cast<uint8_t>((Sums[y * ThumbWidth + x] + Count / 2) / Count);
+        }
+    }
+    return true;
+}
+
+float CompareLumaThumbnails(const std::vector<uint8_t> &A, const std::vector<uint8_t> &B) {
+    if (A.size() != B.size() || A.size() < 3 || A[0] != B[0] || A[1] != B[1])
+        return 1.0f;
+    size_t Count = A.size() - 2;
+    return AbsDiffBytes(A.data() + 2, B.data() + 2, Count) / (255.0f * Count);
+}
@@ -0,0 +1,40 @@
+//  Copyright (c) 2026 The FFmpegSource Project
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#ifndef SCENEDETECT_H
+#define SCENEDETECT_H
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+#include <cstdint>
+#include <vector>
+
+// Reduces the luma plane of Frame to a small grid of block averages which is
+// cheap to compare between frames. Returns false for formats without a
+// directly readable luma plane (RGB, paletted, hardware and so on).
+bool ComputeLumaThumbnail(const AVFrame *Frame, std::vector<uint8_t> &Thumb);
+
+// Mean absolute difference of two thumbnails in the range [0, 1]. Thumbnails
+// of differently sized frames are considered completely different.
+float CompareLumaThumbnails(const std::vector<uint8_t> &A, const std::vector<uint8_t> &B);
+
+#endif
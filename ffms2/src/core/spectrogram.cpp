@@ -0,0 +1,264 @@
+//  Copyright (c) 2026 The FFmpegSource Project
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "spectrogram.h"
+#include "simd.h"
+
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const double Pi = 3.14159265358979323846;
+
+template<typename T>
+void MixSamples(const uint8_t *Src, size_t PlaneSize, bool Planar, int Channels, size_t Count, float Offset, float Scale, float *Dst) {
+    const float ChannelScale = Scale / Channels;
+    for (size_t i = 0; i < Count; i++) {
+        float Sum = 0;
+        for (int c = 0; c < Channels; c++) {
+            T Value = Planar
+                ? reinterpret_cast<const T *>(Src + c * PlaneSize)[i]
+                : reinterpret_cast<const T *>(Src)[i * Channels + c];
+            Sum += static_cast<float>(Value) - Offset;
+        }
+        Dst[i] = Sum * ChannelScale;
+    }
+}
+
+double HzToMel(double Hz) {
+    return 2595. * std::log10(1. + Hz / 700.);
+}
+
+double MelToHz(double Mel) {
+    return 700. * (std::pow(10., Mel / 2595.) - 1.);
+}
+
+float Dot(const float *A, const float *B, size_t Count) {
+    size_t i = 0;
+    float Sum = 0;
+#ifdef FFMS_SSE2
+    __m128 Acc = _mm_setzero_ps();
+    for (; i + 4 <= Count; i += 4)
+        Acc = _mm_add_ps(Acc, _mm_mul_ps(_mm_loadu_ps(A + i), _mm_loadu_ps(B + i)));
+    float Lanes[4];
+    _mm_storeu_ps(Lanes, Acc);
+    Sum = (Lanes[0] + Lanes[1]) + (Lanes[2] + Lanes[3]);
+#endif
+    for (; i < Count; i++)
+        Sum += A[i] * B[i];
+    return Sum;
+}
+
+}
+
+int GetSpectrogramBins(const FFMS_SpectrogramOptions &Options) {
+    const int N = Options.WindowSize;
+    if (N < 16 || N > 65536 || (N & (N - 1)) || Options.HopSize <= 0 || Options.MelBands < 0)
+        return 0;
+    return Options.MelBands ? Options.MelBands : N / 2 + 1;
+}
+
+void MixToMono(const uint8_t *Src, size_t PlaneSize, AVSampleFormat Format, int Channels, size_t Count, float *Dst) {
+    const bool Planar = !!av_sample_fmt_is_planar(Format);
+    switch (av_get_packed_sample_fmt(Format)) {
+    case AV_SAMPLE_FMT_U8:  MixSamples<uint8_t>(Src, PlaneSize, Planar, Channels, Count, 128.f, 1.f / 128, Dst); break;
+    case AV_SAMPLE_FMT_S16: MixSamples<int16_t>(Src, PlaneSize, Planar, Channels, Count, 0.f, 1.f / 32768, Dst); break;
+    case AV_SAMPLE_FMT_S32: MixSamples<int32_t>(Src, PlaneSize, Planar, Channels, Count, 0.f, 1.f / 2147483648.f, Dst); break;
+    case AV_SAMPLE_FMT_FLT: MixSamples<float>(Src, PlaneSize, Planar, Channels, Count, 0.f, 1.f, Dst); break;
+    case AV_SAMPLE_FMT_DBL: MixSamples<double>(Src, PlaneSize, Planar, Channels, Count, 0.f, 1.f, Dst); break;
+    default:
+        throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_UNSUPPORTED,
+            "Unsupported sample format for spectrograms");
+    }
+}
+
+Spectrogram::Spectrogram(const FFMS_SpectrogramOptions &Options, int SampleRate)
+    : Options(Options) {
+    if (!GetSpectrogramBins(Options))
+        throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_INVALID_ARGUMENT,
+            "Invalid spectrogram options");
+
+    const size_t N = Options.WindowSize;
+    const size_t M = N / 2;
+
+    // Periodic Hann window, as used for spectral analysis
+    Window.resize(N);
+    for (size_t i = 0; i < N; i++)
+        Window[i] = static_cast<float>(0.5 - 0.5 * std::cos(2 * Pi * i / N));
+
+    // The real input is transformed as a complex sequence of half the length
+    // with the even samples as the real part and the odd ones as the
+    // imaginary part
+    size_t Bits = 0;
+    while ((static_cast<size_t>(1) << Bits) < M)
+        ++Bits;
+    Reverse.resize(M);
+    for (size_t i = 0; i < M; i++) {
+        uint32_t r = 0;
+        for (size_t b = 0; b < Bits; b++)
+            r |= ((i >> b) & 1) << (Bits - 1 - b);
+        Reverse[i] = r;
+    }
+
+    TwiddleRe.resize(M);
+    TwiddleIm.resize(M);
+    for (size_t h = 1; h < M; h <<= 1) {
+        for (size_t j = 0; j < h; j++) {
+            TwiddleRe[h + j] = static_cast<float>(std::cos(Pi * j / h));
+            TwiddleIm[h + j] = static_cast<float>(-std::sin(Pi * j / h));
+        }
+    }
+
+    SplitRe.resize(M + 1);
+    SplitIm.resize(M + 1);
+    for (size_t k = 0; k <= M; k++) {
+        SplitRe[k] = static_cast<float>(std::cos(2 * Pi * k / N));
+        SplitIm[k] = static_cast<float>(std::sin(2 * Pi * k / N));
+    }
+
+    Windowed.resize(N);
+    Re.resize(M);
+    Im.resize(M);
+    Power.resize(M + 1);
+
+    if (!Options.MelBands)
+        return;
+
+    // Triangular filters evenly spaced on the mel scale
+    const double Nyquist = SampleRate / 2.;
+    const double MaxFrequency = Options.MaxFrequency > 0 ? Options.MaxFrequency : Nyquist;
+    if (Options.MinFrequency < 0 || MaxFrequency <= Options.MinFrequency || MaxFrequency > Nyquist)
+        throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_INVALID_ARGUMENT,
+            "Invalid spectrogram frequency range");
+
+    const double MinMel = HzToMel(Options.MinFrequency);
+    const double MaxMel = HzToMel(MaxFrequency);
+    const double BinHz = static_cast<double>(SampleRate) / N;
+    FilterStart.resize(Options.MelBands);
+    Filters.resize(Options.MelBands);
+    for (int m = 0; m < Options.MelBands; m++) {
+        double Lo = MelToHz(MinMel + (MaxMel - MinMel) * m / (Options.MelBands + 1));
+        double Center = MelToHz(MinMel + (MaxMel - MinMel) * (m + 1) / (Options.MelBands + 1));
+        double Hi = MelToHz(MinMel + (MaxMel - MinMel) * (m + 2) / (Options.MelBands + 1));
+
+        size_t First = static_cast<size_t>(std::ceil(Lo / BinHz));
+        size_t Last = std::min(static_cast<size_t>(std::floor(Hi / BinHz)), M);
+        FilterStart[m] = static_cast<int>(std::min(First, M));
+        for (size_t k = First; k <= Last; k++) {
+            double f = k * BinHz;
+            double Weight = f <= Center ? (f - Lo) / (Center - Lo) : (Hi - f) / (Hi - Center);
+            Filters[m].push_back(static_cast<float>(std::max(Weight, 0.)));
+        }
+    }
+
+    if (this->Options.LogFloor <= 0)
+        this->Options.LogFloor = 1e-10f;
+}
+
+int Spectrogram::GetBins() const {
+    return GetSpectrogramBins(Options);
+}
+
+void Spectrogram::FFT() {
+    const size_t M = Re.size();
+    float *R = Re.data();
+    float *I = Im.data();
+    for (size_t h = 1; h < M; h <<= 1) {
+        const float *WR = TwiddleRe.data() + h;
+        const float *WI = TwiddleIm.data() + h;
+        for (size_t i = 0; i < M; i += 2 * h) {
+            size_t j = 0;
+#ifdef FFMS_SSE2
+            for (; j + 4 <= h; j += 4) {
+                __m128 AR = _mm_loadu_ps(R + i + j);
+                __m128 AI = _mm_loadu_ps(I + i + j);
+                __m128 BR = _mm_loadu_ps(R + i + j + h);
+                __m128 BI = _mm_loadu_ps(I + i + j + h);
+                __m128 CR = _mm_loadu_ps(WR + j);
+                __m128 CI = _mm_loadu_ps(WI + j);
+                __m128 TR = _mm_sub_ps(_mm_mul_ps(BR, CR), _mm_mul_ps(BI, CI));
+                __m128 TI = _mm_add_ps(_mm_mul_ps(BR, CI), _mm_mul_ps(BI, CR));
+                _mm_storeu_ps(R + i + j, _mm_add_ps(AR, TR));
+                _mm_storeu_ps(I + i + j, _mm_add_ps(AI, TI));
+                _mm_storeu_ps(R + i + j + h, _mm_sub_ps(AR, TR));
+                _mm_storeu_ps(I + i + j + h, _mm_sub_ps(AI, TI));
+            }
+#endif
+            for (; j < h; j++) {
+                float TR = R[i + j + h] * WR[j] - I[i + j + h] * WI[j];
+                float TI = R[i + j + h] * WI[j] + I[i + j + h] * WR[j];
+                R[i + j + h] = R[i + j] - TR;
+                I[i + j + h] = I[i + j] - TI;
+                R[i + j] += TR;
+                I[i + j] += TI;
+            }
+        }
+    }
+}
+
+void Spectrogram::ComputeFrame(const float *Samples, float *Out) {
+    const size_t N = Window.size();
+    const size_t M = N / 2;
+
+    size_t i = 0;
+#ifdef FFMS_SSE2
+    for (; i + 4 <= N; i += 4)
+        _mm_storeu_ps(&Windowed[i], _mm_mul_ps(_mm_loadu_ps(Samples + i), _mm_loadu_ps(&Window[i])));
+#endif
+    for (; i < N; i++)
+        Windowed[i] = Samples[i] * Window[i];
+
+    for (size_t k = 0; k < M; k++) {
+        Re[Reverse[k]] = Windowed[2 * k];
+        Im[Reverse[k]] = Windowed[2 * k + 1];
+    }
+
+    FFT();
+
+    // Separate the transforms of the even and odd samples and combine them
+    // into bins 0 to M of the real transform
+    for (size_t k = 0; k <= M; k++) {
+        size_t a = k % M;
+        size_t b = (M - k) % M;
+        float AR = Re[a], AI = Im[a];
+        float BR = Re[b], BI = -Im[b];
+        float ER = (AR + BR) * 0.5f;
+        float EI = (AI + BI) * 0.5f;
+        float OR = (AI - BI) * 0.5f;
+        float OI = (BR - AR) * 0.5f;
+        float XR = ER + OR * SplitRe[k] + OI * SplitIm[k];
+        float XI = EI + OI * SplitRe[k] - OR * SplitIm[k];
+        Power[k] = XR * XR + XI * XI;
+    }
+
+    if (!Options.MelBands) {
+        for (size_t k = 0; k <= M; k++)
+            Out[k] = std::sqrt(Power[k]);
+        return;
+    }
+
+    for (int m = 0; m < Options.MelBands; m++) {
+        float Energy = Dot(&Power[FilterStart[m]], Filters[m].data(), Filters[m].size());
+        Out[m] = std::log(std::max(Energy, Options.LogFloor));
+    }
+}
@@ -0,0 +1,72 @@
+//  Copyright (c) 2026 The FFmpegSource Project
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#ifndef SPECTROGRAM_H
+#define SPECTROGRAM_H
+
+extern "C" {
+#include <libavutil/samplefmt.h>
+}
+
+#include "ffms.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Number of values per frame for the given options, or 0 if they're invalid
+int GetSpectrogramBins(const FFMS_SpectrogramOptions &Options);
+
+// Averages the channels of Count samples into Dst. Planar formats have
+// their planes PlaneSize bytes apart.
+void MixToMono(const uint8_t *Src, size_t PlaneSize, AVSampleFormat Format, int Channels, size_t Count, float *Dst);
+
+// Hann windowed STFT of single frames, either as magnitudes or as log-mel
+// band energies
+class Spectrogram {
+    FFMS_SpectrogramOptions Options;
+    std::vector<float> Window;
+    // bit reversed order of the FFT input
+    std::vector<uint32_t> Reverse;
+    // twiddle factors for the FFT stage combining blocks of 2 * h at [h, 2 * h)
+    std::vector<float> TwiddleRe;
+    std::vector<float> TwiddleIm;
+    // twiddle factors for splitting the half size complex FFT into the real one
+    std::vector<float> SplitRe;
+    std::vector<float> SplitIm;
+    // mel filters, stored as the first bin each covers and its weights
+    std::vector<int> FilterStart;
+    std::vector<std::vector<float>> Filters;
+    // scratch space
+    std::vector<float> Windowed;
+    std::vector<float> Re;
+    std::vector<float> Im;
+    std::vector<float> Power;
+
+    void FFT();
+
+public:
+    Spectrogram(const FFMS_SpectrogramOptions &Options, int SampleRate);
+    int GetBins() const;
+    // Computes one frame from WindowSize samples
+    void ComputeFrame(const float *Samples, float *Out);
+};
+
+#endif
@@ -0,0 +1,151 @@
+//  Copyright (c) 2026 The FFmpegSource Project
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "tensor.h"
+#include "simd.h"
+
+#include <cstring>
+#include <vector>
+
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Dst[x] = Src[x] * Mul + Add
+void RowToFloat(const uint8_t *Src, float *Dst, int Width, float Mul, float Add) {
+    int x = 0;
+#ifdef FFMS_SSE2
+    const __m128i Zero = _mm_setzero_si128();
+    const __m128 M = _mm_set1_ps(Mul);
+    const __m128 A = _mm_set1_ps(Add);
+    for (; x + 16 <= Width; x += 16) {
+        __m128i Pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(Src + x));
+        __m128i Lo = _mm_unpacklo_epi8(Pixels, Zero);
+        __m128i Hi = _mm_unpackhi_epi8(Pixels, Zero);
+        __m128 F0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(Lo, Zero));
+        __m128 F1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(Lo, Zero));
+        __m128 F2 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(Hi, Zero));
+        __m128 F3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(Hi, Zero));
+        _mm_storeu_ps(Dst + x, _mm_add_ps(_mm_mul_ps(F0, M), A));
+        _mm_storeu_ps(Dst + x + 4, _mm_add_ps(_mm_mul_ps(F1, M), A));
+        _mm_storeu_ps(Dst + x + 8, _mm_add_ps(_mm_mul_ps(F2, M), A));
+        _mm_storeu_ps(Dst + x + 12, _mm_add_ps(_mm_mul_ps(F3, M), A));
+    }
+#endif
+    for (; x < Width; x++)
+        Dst[x] = Src[x] * Mul + Add;
+}
+
+// Round to nearest even, with overflow going to infinity and NaN preserved
+uint16_t FloatToHalf(float Value) {
+    const uint32_t F32Infinity = 255u << 23;
+    const uint32_t F16Max = (127u + 16u) << 23;
+    const uint32_t DenormMagicBits = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+
+    uint32_t Bits;
+    memcpy(&Bits, &Value, sizeof(Bits));
+    uint32_t Sign = Bits & 0x80000000u;
+    Bits ^= Sign;
+
+    uint16_t Result;
+    if (Bits >= F16Max) {
+        Result = (Bits > F32Infinity) ? 0x7E00 : 0x7C00;
+    } else if (Bits < (113u << 23)) {
+        float DenormMagic, Magnitude;
+        memcpy(&DenormMagic, &DenormMagicBits, sizeof(DenormMagic));
+        memcpy(&Magnitude, &Bits, sizeof(Magnitude));
+        Magnitude += DenormMagic;
+        memcpy(&Bits, &Magnitude, sizeof(Bits));
+        Result = static_cast<uint16_t>(Bits - DenormMagicBits);
+    } else {
+        uint32_t MantissaOdd = (Bits >> 13) & 1;
+        Bits += ((15u - 127u) << 23) + 0xFFF;
+        Bits += MantissaOdd;
+        Result = static_cast<uint16_t>(Bits >> 13);
+    }
+    return static_cast<uint16_t>(Result | (Sign >> 16));
+}
+
+void FloatsToHalves(const float *Src, uint16_t *Dst, int Count) {
+    int i = 0;
+#ifdef __F16C__
+    for (; i + 8 <= Count; i += 8)
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(Dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(Src + i), _MM_FROUND_TO_NEAREST_INT));
+#endif
+    for (; i < Count; i++)
+        Dst[i] = FloatToHalf(Src[i]);
+}
+
+}
+
+size_t GetTensorFrameSize(const FFMS_TensorOptions &Options) {
+    size_t ElementSize = (Options.DataType == FFMS_TENSOR_FLOAT16) ? sizeof(uint16_t) : sizeof(float);
+    return static_cast<size_t>(Options.Width) * Options.Height * 3 * ElementSize;
+}
+
+void WriteTensor(const uint8_t *const Planes[3], const int Linesize[3], const FFMS_TensorOptions &Options, void *Dst) {
+    const int Width = Options.Width;
+    const int Height = Options.Height;
+    const size_t PlaneSize = static_cast<size_t>(Width) * Height;
+
+    float Mul[3], Add[3];
+    for (int c = 0; c < 3; c++) {
+        Mul[c] = Options.Scale / Options.Std[c];
+        Add[c] = -Options.Mean[c] / Options.Std[c];
+    }
+
+    // Planar float32 output can be written directly, everything else goes
+    // through a row of floats per channel
+    if (Options.Layout == FFMS_TENSOR_LAYOUT_CHW && Options.DataType == FFMS_TENSOR_FLOAT32) {
+        float *Out = static_cast<float *>(Dst);
+        for (int c = 0; c < 3; c++)
+            for (int y = 0; y < Height; y++)
+                RowToFloat(Planes[c] + static_cast<ptrdiff_t>(y) * Linesize[c], Out + c * PlaneSize + static_cast<size_t>(y) * Width, Width, Mul[c], Add[c]);
+        return;
+    }
+
+    std::vector<float> Row(static_cast<size_t>(Width) * 3);
+    std::vector<float> Interleaved;
+    if (Options.Layout == FFMS_TENSOR_LAYOUT_HWC)
+        Interleaved.resize(static_cast<size_t>(Width) * 3);
+
+    for (int y = 0; y < Height; y++) {
+        for (int c = 0; c < 3; c++)
+            RowToFloat(Planes[c] + static_cast<ptrdiff_t>(y) * Linesize[c], &Row[c * Width], Width, Mul[c], Add[c]);
+
+        if (Options.Layout == FFMS_TENSOR_LAYOUT_HWC) {
+            const float *R = &Row[0], *G = &Row[Width], *B = &Row[2 * Width];
+            float *Out = (Options.DataType == FFMS_TENSOR_FLOAT32) ? static_cast<float *>(Dst) + static_cast<size_t>(y) * Width * 3 : Interleaved.data();
+            for (int x = 0; x < Width; x++) {
+                Out[x * 3] = R[x];
+                Out[x * 3 + 1] = G[x];
+                Out[x * 3 + 2] = B[x];
+            }
+            if (Options.DataType == FFMS_TENSOR_FLOAT16)
+                FloatsToHalves(Out, static_cast<uint16_t *>(Dst) + static_cast<size_t>(y) * Width * 3, Width * 3);
+        } else {
+            uint16_t *Out = static_cast<uint16_t *>(Dst);
+            for (int c = 0; c < 3; c++)
+                FloatsToHalves(&Row[c * Width], Out + c * PlaneSize + static_cast<size_t>(y) * Width, Width);
+        }
+    }
+}
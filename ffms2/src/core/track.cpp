@@ -104,6 +104,25 @@ FFMS_Track::FFMS_Track(ZipFile &stream)
 
     if (TT == FFMS_TYPE_VIDEO)
         GeneratePublicInfo();
+
+    if (TT == FFMS_TYPE_AUDIO) {
+        std::vector<AudioSeekPoint> &SeekTable = Data->AudioSeekTable;
+        size_t SeekPoints = static_cast<size_t>(stream.Read<uint64_t>());
+        AudioSeekPoint prev{};
+        SeekTable.reserve(SeekPoints);
+        for (size_t i = 0; i < SeekPoints; ++i) {
+            AudioSeekPoint p;
+            p.SampleStart = stream.Read<int64_t>() + prev.SampleStart;
+            p.Packet = stream.Read<uint32_t>() + prev.Packet;
+            p.SeekPacket = p.Packet - stream.Read<uint32_t>();
+            SeekTable.push_back(p);
+            prev = p;
+        }
+
+        Data->Peaks.Read(stream);
+        Data->PCMOffset = stream.Read<int64_t>();
+        Data->PCMBlockAlign = stream.Read<int32_t>();
+    }
 }
 
 void FFMS_Track::Write(ZipFile &stream) const {
@@ -122,6 +141,22 @@ void FFMS_Track::Write(ZipFile &stream) const {
     FrameInfo temp{};
     for (size_t i = 0; i < size(); ++i)
         WriteFrame(stream, Frames[i], i == 0 ? temp : Frames[i - 1], TT);
+
+    if (TT == FFMS_TYPE_AUDIO) {
+        std::vector<AudioSeekPoint> &SeekTable = Data->AudioSeekTable;
+        stream.Write<uint64_t>(SeekTable.size());
+        AudioSeekPoint prev{};
+        for (auto const& p : SeekTable) {
+            stream.Write<int64_t>(p.SampleStart - prev.SampleStart);
+            stream.Write<uint32_t>(p.Packet - prev.Packet);
+            stream.Write<uint32_t>(p.Packet - p.SeekPacket);
+            prev = p;
+        }
+
+        Data->Peaks.Write(stream);
+        stream.Write<int64_t>(Data->PCMOffset);
+        stream.Write<int32_t>(Data->PCMBlockAlign);
+    }
 }
 
 void FFMS_Track::AddVideoFrame(int64_t PTS, int RepeatPict, bool KeyFrame, int FrameType, int64_t FilePos, bool Hidden) {
@@ -323,6 +358,70 @@ void FFMS_Track::FillAudioGaps() {
     }
 }
 
+FFMS_Track FFMS_Track::Unfinalized(size_t Count) const {
+    FFMS_Track Track(*this);
+    Track.Data = std::make_shared<TrackData>();
+    frame_vec &Frames = Track.Data->Frames;
+    Count = std::min(Count, size());
+    Frames.assign(begin(), begin() + Count);
+
+    // Audio frames are never reordered, and finalizing them again leaves
+    // already filled gaps and shifted timestamps as they are
+    if (TT != FFMS_TYPE_VIDEO)
+        return Track;
+
+    // The frame at position OriginalPos of each frame is the one which was
+    // decoded at that frame's position
+    for (size_t i = 0; i < Count; i++) {
+        Frames[i] = Data->Frames[Data->Frames[i].OriginalPos];
+        Frames[i].PTS = Frames[i].OriginalPTS;
+    }
+    return Track;
+}
+
+size_t FFMS_Track::ResumePoint(size_t Margin, int64_t &RestartPos, size_t &Warmup) const {
+    const frame_vec &Frames = Data->Frames;
+    RestartPos = -1;
+    Warmup = 0;
+    if (size() <= Margin)
+        return 0;
+
+    if (TT == FFMS_TYPE_AUDIO) {
+        // Decoding from a seek point's packet gives the right output from
+        // the frame at its SampleStart on
+        const std::vector<AudioSeekPoint> &SeekTable = Data->AudioSeekTable;
+        for (auto it = SeekTable.rbegin(); it != SeekTable.rend(); ++it) {
+            FrameInfo f;
+            f.SampleStart = it->SampleStart;
+            size_t Keep = std::distance(Frames.begin(), std::lower_bound(Frames.begin(), Frames.end(), f,
+                [](FrameInfo const& a, FrameInfo const& b) { return a.SampleStart < b.SampleStart; }));
+            if (Keep + Margin <= size() && it->Packet <= Keep && Frames[it->Packet].FilePos >= 0) {
+                RestartPos = Frames[it->Packet].FilePos;
+                Warmup = Keep - it->Packet;
+                return Keep;
+            }
+        }
+        return 0;
+    }
+
+    // Everything else starts over at a keyframe in decoding order
+    for (size_t Keep = size() - Margin; Keep > 0; --Keep) {
+        const FrameInfo &Frame = TT == FFMS_TYPE_VIDEO ? Frames[Frames[Keep].OriginalPos] : Frames[Keep];
+        if (Frame.KeyFrame && Frame.FilePos >= 0) {
+            RestartPos = Frame.FilePos;
+            return Keep;
+        }
+    }
+    return 0;
+}
+
+FFMS_Track FFMS_Track::Snapshot(size_t Count) const {
+    FFMS_Track Track(*this);
+    Track.Data = std::make_shared<TrackData>();
+    Track.Data->Frames.assign(begin(), begin() + std::min(Count, size()));
+    return Track;
+}
+
 void FFMS_Track::FinalizeTrack() {
     frame_vec &Frames = Data->Frames;
     // With some formats (such as Vorbis) a bad final packet results in a
@@ -391,6 +490,102 @@ void FFMS_Track::FinalizeTrack() {
     GeneratePublicInfo();
 }
 
+namespace {
+    // Seek targets are grouped so that the table is a fraction of the size
+    // of the track, at the cost of decoding at most this many extra packets
+    const size_t AudioSeekGranularity = 8;
+}
+
+void FFMS_Track::BuildAudioSeekTable(size_t PreRoll) {
+    frame_vec &Frames = Data->Frames;
+    std::vector<AudioSeekPoint> &SeekTable = Data->AudioSeekTable;
+    SeekTable.clear();
+
+    // Last keyframe at or before the packet being scanned, and the first
+    // packet of the run of packets with the same PTS it's in
+    size_t Scan = 0;
+    size_t LastKey = 0;
+    size_t KeyRunStart = 0;
+    size_t RunStart = 0;
+    for (size_t i = 0; i < size(); i += AudioSeekGranularity) {
+        size_t Start = i > PreRoll ? i - PreRoll : 0;
+        for (; Scan <= Start; ++Scan) {
+            if (Scan > 0 && Frames[Scan].PTS != Frames[Scan - 1].PTS)
+                RunStart = Scan;
+            if (Scan == 0 || Frames[Scan].KeyFrame) {
+                LastKey = Scan;
+                KeyRunStart = RunStart;
+            }
+        }
+
+        if (!SeekTable.empty() && SeekTable.back().Packet == LastKey)
+            continue;
+
+        // Packets don't always have unique PTSes, so we may not be able to
+        // uniquely identify the packet we want. In that case seek to the
+        // packet before the run of packets with the same PTS instead, so
+        // that after seeking we can decode until the PTS changes and know
+        // that we're at the first packet in the run rather than whatever the
+        // splitter happened to choose.
+
+        // MatroskaAudioSource doesn't need this, as it seeks by byte offset
+        // rather than PTS. LAVF theoretically can seek by byte offset, but we
+        // don't use it as not all demuxers support it and it's broken in some of
+        // those that claim to support it
+
+        // This doesn't work if our desired packet has the same PTS as the first
+        // packet, but this scenario should never come up anyway; we permanently
+        // cache the decoded results from those packets, so there's no need to ever
+        // seek to them
+        size_t SeekPacket = LastKey;
+        bool Unique = KeyRunStart == LastKey &&
+            (LastKey + 1 == size() || Frames[LastKey + 1].PTS != Frames[LastKey].PTS);
+        if (!Unique)
+            SeekPacket = KeyRunStart > 0 ? KeyRunStart - 1 : 0;
+
+        SeekTable.push_back({ Frames[i].SampleStart, static_cast<uint32_t>(LastKey), static_cast<uint32_t>(SeekPacket) });
+    }
+}
+
+const AudioSeekPoint &FFMS_Track::FindAudioSeekPoint(int64_t Sample) const {
+    std::vector<AudioSeekPoint> &SeekTable = Data->AudioSeekTable;
+    auto it = std::upper_bound(SeekTable.begin(), SeekTable.end(), Sample,
+        [](int64_t Sample, AudioSeekPoint const& p) { return Sample < p.SampleStart; });
+    return it == SeekTable.begin() ? SeekTable.front() : *(it - 1);
+}
+
+void FFMS_Track::DetectPCMLayout(int BlockAlign) {
+    frame_vec &Frames = Data->Frames;
+    Data->PCMOffset = -1;
+    Data->PCMBlockAlign = 0;
+    if (BlockAlign <= 0 || empty() || front().SampleStart != 0 || front().FilePos < 0)
+        return;
+
+    // Filling gaps in the timestamps or dropping a packet while finalizing
+    // breaks the correspondence between positions and samples, which this
+    // catches as well
+    const int64_t Offset = front().FilePos;
+    for (size_t i = 0; i < size(); i++) {
+        if (Frames[i].Hidden || Frames[i].FilePos != Offset + Frames[i].SampleStart * BlockAlign)
+            return;
+        if (i > 0 && Frames[i].SampleStart != Frames[i - 1].SampleStart + Frames[i - 1].SampleCount)
+            return;
+    }
+
+    Data->PCMOffset = Offset;
+    Data->PCMBlockAlign = BlockAlign;
+}
+
+bool FFMS_Track::GetPCMLayout(int64_t &Offset, int &BlockAlign) const {
+    Offset = Data->PCMOffset;
+    BlockAlign = Data->PCMBlockAlign;
+    return BlockAlign > 0;
+}
+
+void FFMS_Track::SetAudioPeaks(AudioPeakPyramid &&Peaks) {
+    Data->Peaks = std::move(Peaks);
+}
+
 void FFMS_Track::GeneratePublicInfo() {
     frame_vec &Frames = Data->Frames;
     std::vector<int> &RealFrameNumbers = Data->RealFrameNumbers;
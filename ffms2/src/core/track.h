@@ -22,6 +22,7 @@
 #define TRACK_H
 
 #include "ffms.h"
+#include "peaks.h"
 
 #include <cstddef>
 #include <vector>
@@ -42,6 +43,15 @@ struct FrameInfo {
     bool Hidden;
 };
 
+// Where to start decoding to get to the samples starting at SampleStart
+struct AudioSeekPoint {
+    int64_t SampleStart;
+    // Keyframe which decoding starts from, including the pre-roll
+    uint32_t Packet;
+    // Packet with a unique PTS at or before Packet for the demuxer to seek to
+    uint32_t SeekPacket;
+};
+
 struct FFMS_Track {
 private:
     typedef std::vector<FrameInfo> frame_vec;
@@ -49,6 +59,12 @@ private:
         frame_vec Frames;
         std::vector<int> RealFrameNumbers;
         std::vector<FFMS_FrameInfo> PublicFrameInfo;
+        std::vector<AudioSeekPoint> AudioSeekTable;
+        AudioPeakPyramid Peaks;
+        // Start of the samples and bytes per sample for all channels if the
+        // packets are one contiguous run of PCM in the file
+        int64_t PCMOffset = -1;
+        int PCMBlockAlign = 0;
     };
 
     std::shared_ptr<TrackData> Data;
@@ -72,6 +88,30 @@ public:
 
     void MaybeHideFrames();
     void FinalizeTrack();
+    // Copy of the first Count frames of a finalized track in decoding order
+    // and with their original timestamps, which more packets can be added to
+    // before finalizing it again
+    FFMS_Track Unfinalized(size_t Count) const;
+    // Number of frames in decoding order to keep to continue indexing from
+    // at least Margin frames before the end of a finalized track, and where
+    // to start reading again to get there, along with the number of packets
+    // from there which only bring the decoder up to speed
+    size_t ResumePoint(size_t Margin, int64_t &RestartPos, size_t &Warmup) const;
+    // Copy of the first Count frames of a track which is still being
+    // indexed, which can be finalized on its own
+    FFMS_Track Snapshot(size_t Count) const;
+    // PreRoll is the number of packets the decoder needs before the target
+    void BuildAudioSeekTable(size_t PreRoll);
+
+    const AudioSeekPoint &FindAudioSeekPoint(int64_t Sample) const;
+
+    void SetAudioPeaks(AudioPeakPyramid &&Peaks);
+    const AudioPeakPyramid &GetAudioPeaks() const { return Data->Peaks; }
+
+    // Records the layout if every packet is BlockAlign bytes per sample and
+    // directly follows the previous one in the file
+    void DetectPCMLayout(int BlockAlign);
+    bool GetPCMLayout(int64_t &Offset, int &BlockAlign) const;
 
     int FindClosestVideoKeyFrame(int Frame) const;
     int FrameFromPTS(int64_t PTS) const;
@@ -21,9 +21,16 @@
 #include "videosource.h"
 #include "indexing.h"
 #include "videoutils.h"
+#include "tensor.h"
+#include "scenedetect.h"
+#include "framepool.h"
+#include "zipfile.h"
 #include <algorithm>
+#include <numeric>
 #include <thread>
 
+#define SCENEID 0x53434E53
+#define SCENE_VERSION 1
 
 void FFMS_VideoSource::SanityCheckFrameForData(AVFrame *Frame) {
     for (int i = 0; i < 4; i++) {
@@ -125,10 +132,70 @@ FFMS_Frame *FFMS_VideoSource::OutputFrame(AVFrame *Frame) {
     LastFrameHeight = Frame->height;
     LastFrameWidth = Frame->width;
     LastFramePixelFormat = (AVPixelFormat) Frame->format;
+    OutputPending = false;
 
     return &LocalFrame;
 }
 
+void FFMS_VideoSource::ReAdjustTensorFormat(AVFrame *Frame) {
+    if (TensorSWS) {
+        sws_freeContext(TensorSWS);
+        TensorSWS = nullptr;
+    }
+
+    if (!InputFormatOverridden) {
+        InputFormat = AV_PIX_FMT_NONE;
+        InputColorSpace = AVCOL_SPC_UNSPECIFIED;
+        InputColorRange = AVCOL_RANGE_UNSPECIFIED;
+    }
+    DetectInputFormat();
+
+    // Frames which already are full size planar RGB are normalized in place
+    if (InputFormat != AV_PIX_FMT_GBRP || Frame->width != TensorOptions.Width || Frame->height != TensorOptions.Height) {
+        TensorSWS = GetSwsContext(
+            Frame->width, Frame->height, InputFormat, InputColorSpace, InputColorRange,
+            TensorOptions.Width, TensorOptions.Height, AV_PIX_FMT_GBRP, AVCOL_SPC_RGB, AVCOL_RANGE_JPEG,
+            TensorOptions.Resizer ? TensorOptions.Resizer : FFMS_RESIZER_BICUBIC);
+
+        if (!TensorSWS)
+            throw FFMS_Exception(FFMS_ERROR_SCALING, FFMS_ERROR_INVALID_ARGUMENT,
+                "Failed to allocate SWScale context");
+    }
+
+    TensorFrameWidth = Frame->width;
+    TensorFrameHeight = Frame->height;
+    TensorFramePixelFormat = (AVPixelFormat) Frame->format;
+}
+
+void FFMS_VideoSource::OutputTensor(AVFrame *Frame, void *Buf) {
+    SanityCheckFrameForData(Frame);
+
+    if (TensorFrameWidth != Frame->width || TensorFrameHeight != Frame->height || TensorFramePixelFormat != Frame->format)
+        ReAdjustTensorFormat(Frame);
+
+    // GBRP stores its planes as G, B, R
+    const uint8_t *Planes[3];
+    int Linesize[3];
+    if (TensorSWS) {
+        sws_scale(TensorSWS, Frame->data, Frame->linesize, 0, Frame->height, TensorFrameData, TensorFrameLinesize);
+        Planes[0] = TensorFrameData[2];
+        Planes[1] = TensorFrameData[0];
+        Planes[2] = TensorFrameData[1];
+        Linesize[0] = TensorFrameLinesize[2];
+        Linesize[1] = TensorFrameLinesize[0];
+        Linesize[2] = TensorFrameLinesize[1];
+    } else {
+        Planes[0] = Frame->data[2];
+        Planes[1] = Frame->data[0];
+        Planes[2] = Frame->data[1];
+        Linesize[0] = Frame->linesize[2];
+        Linesize[1] = Frame->linesize[0];
+        Linesize[2] = Frame->linesize[1];
+    }
+
+    WriteTensor(Planes, Linesize, TensorOptions, Buf);
+}
+
 FFMS_VideoSource::FFMS_VideoSource(const char *SourceFile, FFMS_Index &Index, int Track, int Threads, int SeekMode)
     : Index(Index), SeekMode(SeekMode) {
 
@@ -151,6 +218,8 @@ FFMS_VideoSource::FFMS_VideoSource(const char *SourceFile, FFMS_Index &Index, in
 
         Frames = Index[Track];
         VideoTrack = Track;
+        SourceFilesize = Index.Filesize;
+        memcpy(SourceDigest, Index.Digest, sizeof(SourceDigest));
 
         if (Threads < 1)
             DecodingThreads = (std::min)(std::thread::hardware_concurrency(), 16u);
@@ -165,7 +234,8 @@ FFMS_VideoSource::FFMS_VideoSource(const char *SourceFile, FFMS_Index &Index, in
                 "Could not allocate dummy frame.");
 
         // Dummy allocations so the unallocated case doesn't have to be handled later
-        if (av_image_alloc(SWSFrameData, SWSFrameLinesize, 16, 16, AV_PIX_FMT_GRAY8, 4) < 0)
+        SWSFrameBuffer = AllocImageBuffer(SWSFrameData, SWSFrameLinesize, 16, 16, AV_PIX_FMT_GRAY8, 4);
+        if (!SWSFrameBuffer)
             throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_ALLOCATION_FAILED,
                 "Could not allocate dummy frame.");
 
@@ -190,6 +260,9 @@ FFMS_VideoSource::FFMS_VideoSource(const char *SourceFile, FFMS_Index &Index, in
         if (CodecContext->codec_id == AV_CODEC_ID_H264 && CodecContext->has_b_frames)
             CodecContext->has_b_frames = 15; // the maximum possible value for h264
 
+        if (GetFramePoolAlignment())
+            CodecContext->get_buffer2 = PooledGetBuffer2;
+
         if (avcodec_open2(CodecContext, Codec, nullptr) < 0)
             throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_CODEC,
                 "Could not open video codec");
@@ -496,8 +569,9 @@ void FFMS_VideoSource::ReAdjustOutputFormat(AVFrame *Frame) {
         }
     }
 
-    av_freep(&SWSFrameData[0]);
-    if (av_image_alloc(SWSFrameData, SWSFrameLinesize, TargetWidth, TargetHeight, OutputFormat, 4) < 0)
+    av_buffer_unref(&SWSFrameBuffer);
+    SWSFrameBuffer = AllocImageBuffer(SWSFrameData, SWSFrameLinesize, TargetWidth, TargetHeight, OutputFormat, 4);
+    if (!SWSFrameBuffer)
         throw FFMS_Exception(FFMS_ERROR_SCALING, FFMS_ERROR_ALLOCATION_FAILED,
             "Could not allocate frame with new resolution.");
 }
@@ -626,6 +700,7 @@ int FFMS_VideoSource::Seek(int n) {
 
     DelayCounter = 0;
     InitialDecode = 1;
+    SeekCount++;
 
     if (!SeekByPos || Frames[n].FilePos < 0) {
         ret = av_seek_frame(FormatContext, VideoTrack, Frames[n].PTS, AVSEEK_FLAG_BACKWARD);
@@ -663,7 +738,10 @@ void FFMS_VideoSource::Free() {
     avformat_close_input(&FormatContext);
     if (SWS)
         sws_freeContext(SWS);
-    av_freep(&SWSFrameData[0]);
+    av_buffer_unref(&SWSFrameBuffer);
+    if (TensorSWS)
+        sws_freeContext(TensorSWS);
+    av_buffer_unref(&TensorFrameBuffer);
     av_frame_free(&DecodeFrame);
     av_frame_free(&LastDecodedFrame);
 }
@@ -731,12 +809,9 @@ bool FFMS_VideoSource::SeekTo(int n, int SeekOffset) {
     return false;
 }
 
-FFMS_Frame *FFMS_VideoSource::GetFrame(int n) {
-    GetFrameCheck(n);
-    n = Frames.RealFrameNumber(n);
-
+void FFMS_VideoSource::DecodeToFrame(int n) {
     if (LastFrameNum == n)
-        return &LocalFrame;
+        return;
 
     int SeekOffset = 0;
     bool Seek = true;
@@ -753,20 +828,26 @@ FFMS_Frame *FFMS_VideoSource::GetFrame(int n) {
         if (HasSeeked || !Hidden)
             DecodeNextFrame(StartTime, FilePos);
 
-        if (!HasSeeked)
+        if (!HasSeeked) {
+            if (!Hidden)
+                AnalyzeFrame(CurrentFrame);
             continue;
+        }
 
         if (StartTime == AV_NOPTS_VALUE && !Frames.HasTS) {
             if (FilePos >= 0) {
                 CurrentFrame = Frames.FrameFromPos(FilePos);
-                if (CurrentFrame >= 0)
+                if (CurrentFrame >= 0) {
+                    AnalyzeFrame(CurrentFrame);
                     continue;
+                }
             }
             // If the track doesn't have timestamps or file positions then
             // just trust that we got to the right place, since we have no
             // way to tell where we are
             else {
                 CurrentFrame = n;
+                AnalyzeFrame(CurrentFrame);
                 continue;
             }
         }
@@ -795,8 +876,251 @@ FFMS_Frame *FFMS_VideoSource::GetFrame(int n) {
                 --Prev;
             CurrentFrame = Prev + 1;
         }
+
+        AnalyzeFrame(CurrentFrame);
     } while (++CurrentFrame <= n);
 
     LastFrameNum = n;
+    OutputPending = true;
+}
+
+FFMS_Frame *FFMS_VideoSource::GetFrame(int n) {
+    GetFrameCheck(n);
+    n = Frames.RealFrameNumber(n);
+
+    if (LastFrameNum == n && !OutputPending)
+        return &LocalFrame;
+
+    DecodeToFrame(n);
     return OutputFrame(DecodeFrame);
 }
+
+void FFMS_VideoSource::SetTensorOutput(const FFMS_TensorOptions &Options) {
+    if (Options.Width <= 0 || Options.Height <= 0)
+        throw FFMS_Exception(FFMS_ERROR_SCALING, FFMS_ERROR_INVALID_ARGUMENT,
+            "Invalid tensor dimensions");
+    if (Options.Layout != FFMS_TENSOR_LAYOUT_CHW && Options.Layout != FFMS_TENSOR_LAYOUT_HWC)
+        throw FFMS_Exception(FFMS_ERROR_SCALING, FFMS_ERROR_INVALID_ARGUMENT,
+            "Invalid tensor layout");
+    if (Options.DataType != FFMS_TENSOR_FLOAT32 && Options.DataType != FFMS_TENSOR_FLOAT16)
+        throw FFMS_Exception(FFMS_ERROR_SCALING, FFMS_ERROR_INVALID_ARGUMENT,
+            "Invalid tensor data type");
+    for (int c = 0; c < 3; c++) {
+        if (Options.Std[c] == 0)
+            throw FFMS_Exception(FFMS_ERROR_SCALING, FFMS_ERROR_INVALID_ARGUMENT,
+                "Tensor standard deviation can't be zero");
+    }
+
+    av_buffer_unref(&TensorFrameBuffer);
+    TensorFrameBuffer = AllocImageBuffer(TensorFrameData, TensorFrameLinesize, Options.Width, Options.Height, AV_PIX_FMT_GBRP, 32);
+    if (!TensorFrameBuffer)
+        throw FFMS_Exception(FFMS_ERROR_SCALING, FFMS_ERROR_ALLOCATION_FAILED,
+            "Could not allocate tensor conversion frame.");
+
+    TensorOptions = Options;
+    TensorOutputSet = true;
+    // Force the conversion context to be recreated on the next frame
+    TensorFrameWidth = -1;
+}
+
+size_t FFMS_VideoSource::GetTensorSize() const {
+    return TensorOutputSet ? GetTensorFrameSize(TensorOptions) : 0;
+}
+
+void FFMS_VideoSource::GetFrameTensor(int n, void *Buf) {
+    if (!TensorOutputSet)
+        throw FFMS_Exception(FFMS_ERROR_SCALING, FFMS_ERROR_USER,
+            "No tensor output format set");
+
+    GetFrameCheck(n);
+    DecodeToFrame(Frames.RealFrameNumber(n));
+    OutputTensor(DecodeFrame, Buf);
+}
+
+void FFMS_VideoSource::GetFrameTensorBatch(const int *FrameNumbers, int NumFrames, void *Buf) {
+    if (!TensorOutputSet)
+        throw FFMS_Exception(FFMS_ERROR_SCALING, FFMS_ERROR_USER,
+            "No tensor output format set");
+    if (NumFrames < 0)
+        throw FFMS_Exception(FFMS_ERROR_SCALING, FFMS_ERROR_INVALID_ARGUMENT,
+            "Negative number of frames requested");
+    if (NumFrames > 0 && (!FrameNumbers || !Buf))
+        throw FFMS_Exception(FFMS_ERROR_SCALING, FFMS_ERROR_INVALID_ARGUMENT,
+            "Frame numbers and output buffer must not be NULL");
+
+    for (int i = 0; i < NumFrames; i++)
+        GetFrameCheck(FrameNumbers[i]);
+
+    // Decode in ascending order so that frames sharing a GOP don't cause
+    // additional seeks no matter which order they were requested in
+    std::vector<int> Order(NumFrames);
+    std::iota(Order.begin(), Order.end(), 0);
+    std::stable_sort(Order.begin(), Order.end(), [&](int a, int b) { return FrameNumbers[a] < FrameNumbers[b]; });
+
+    const size_t FrameSize = GetTensorFrameSize(TensorOptions);
+    for (int i : Order)
+        GetFrameTensor(FrameNumbers[i], static_cast<uint8_t *>(Buf) + FrameSize * i);
+}
+
+int FFMS_VideoSource::ClosestVisibleFrame(int64_t PTS) const {
+    int Low = 0, High = VP.NumFrames - 1;
+    while (Low < High) {
+        int Mid = Low + (High - Low) / 2;
+        if (Frames.GetFrameInfo(Mid)->PTS < PTS)
+            Low = Mid + 1;
+        else
+            High = Mid;
+    }
+    if (Low > 0 && PTS - Frames.GetFrameInfo(Low - 1)->PTS < Frames.GetFrameInfo(Low)->PTS - PTS)
+        return Low - 1;
+    return Low;
+}
+
+bool FFMS_VideoSource::IsSeekableKeyFrame(int n) const {
+    int Real = Frames.RealFrameNumber(n);
+    return Frames[Real].KeyFrame && Frames[Frames[Real].OriginalPos].KeyFrame;
+}
+
+std::vector<int> FFMS_VideoSource::PlanSampleFrames(int Count, int Stride, int Policy, int Tolerance) const {
+    if ((Count > 0) == (Stride > 0))
+        throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_INVALID_ARGUMENT,
+            "Exactly one of sample count and stride must be positive");
+    if (Policy != FFMS_SAMPLE_EXACT && Policy != FFMS_SAMPLE_NEAREST_KEYFRAME)
+        throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_INVALID_ARGUMENT,
+            "Invalid sampling policy");
+    if (Tolerance < 0)
+        throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_INVALID_ARGUMENT,
+            "Invalid keyframe tolerance");
+
+    std::vector<int> Plan;
+    if (Stride > 0) {
+        for (int n = 0; n < VP.NumFrames; n += Stride)
+            Plan.push_back(n);
+    } else {
+        // Spread the samples evenly in time rather than by frame number so
+        // variable framerate content isn't biased towards its dense sections.
+        // Each sample is the center of its share of the track's duration.
+        int64_t First = Frames.GetFrameInfo(0)->PTS;
+        int64_t End = Frames.GetFrameInfo(VP.NumFrames - 1)->PTS + Frames.LastDuration;
+        Plan.reserve(Count);
+        for (int i = 0; i < Count; i++)
+            Plan.push_back(ClosestVisibleFrame(First + static_cast<int64_t>((End - First) * (2.0 * i + 1) / (2.0 * Count))));
+    }
+
+    if (Policy == FFMS_SAMPLE_NEAREST_KEYFRAME) {
+        for (int &n : Plan) {
+            for (int Distance = 0; Distance <= Tolerance; Distance++) {
+                if (n - Distance >= 0 && IsSeekableKeyFrame(n - Distance)) {
+                    n -= Distance;
+                    break;
+                }
+                if (n + Distance < VP.NumFrames && IsSeekableKeyFrame(n + Distance)) {
+                    n += Distance;
+                    break;
+                }
+            }
+        }
+    }
+
+    return Plan;
+}
+
+void FFMS_VideoSource::SampleFrames(int Count, int Stride, int Policy, int Tolerance, TFrameSampleCallback SC, void *SCPrivate) {
+    std::vector<int> Plan = PlanSampleFrames(Count, Stride, Policy, Tolerance);
+
+    // The plan is in ascending order, so GetFrame only ever seeks forward to
+    // the keyframe starting the next sample's GOP when that's cheaper than
+    // decoding through, and repeated samples are served from LocalFrame
+    for (size_t i = 0; i < Plan.size(); i++) {
+        FFMS_Frame *Frame = GetFrame(Plan[i]);
+        if (SC && (*SC)(static_cast<int>(i), Plan[i], Frame, SCPrivate))
+            throw FFMS_Exception(FFMS_ERROR_CANCELLED, FFMS_ERROR_USER,
+                "Cancelled by user");
+    }
+}
+
+void FFMS_VideoSource::AnalyzeFrame(int n) {
+    if (!SceneDetection || n < 0 || n >= static_cast<int>(Frames.size()) || Frames[n].Hidden)
+        return;
+
+    if (!ComputeLumaThumbnail(DecodeFrame, SceneThumb)) {
+        PrevSceneFrame = -1;
+        return;
+    }
+
+    // Only frames decoded back to back can be compared, which is the case
+    // for everything but the first frame after a seek
+    int Prev = n - 1;
+    while (Prev >= 0 && Frames[Prev].Hidden)
+        --Prev;
+
+    if (Prev < 0)
+        SceneScores[n] = 0;
+    else if (Prev == PrevSceneFrame)
+        SceneScores[n] = CompareLumaThumbnails(PrevSceneThumb, SceneThumb);
+
+    std::swap(SceneThumb, PrevSceneThumb);
+    PrevSceneFrame = n;
+}
+
+void FFMS_VideoSource::SetSceneDetection(bool Enable) {
+    if (Enable == SceneDetection)
+        return;
+
+    SceneDetection = Enable;
+    PrevSceneFrame = -1;
+    if (Enable) {
+        SceneScores.resize(Frames.size(), -1);
+        // The last decoded frame is still around so use it as the starting point
+        AnalyzeFrame(LastFrameNum);
+    }
+}
+
+int FFMS_VideoSource::GetSceneScores(float *Scores, int NumScores) const {
+    int Known = 0;
+    for (int i = 0; i < VP.NumFrames; i++) {
+        float Score = SceneScores.empty() ? -1 : SceneScores[Frames.RealFrameNumber(i)];
+        if (Score >= 0)
+            Known++;
+        if (Scores && i < NumScores)
+            Scores[i] = Score;
+    }
+    return Known;
+}
+
+void FFMS_VideoSource::WriteSceneScores(const char *SceneFile) const {
+    ZipFile zf(SceneFile, "wb");
+    zf.Write<uint32_t>(SCENEID);
+    zf.Write<uint16_t>(SCENE_VERSION);
+    zf.Write<int64_t>(SourceFilesize);
+    zf.Write(SourceDigest);
+    zf.Write<uint32_t>(VideoTrack);
+    zf.Write<uint32_t>(static_cast<uint32_t>(Frames.size()));
+    for (size_t i = 0; i < Frames.size(); i++)
+        zf.Write<float>(SceneScores.empty() ? -1.0f : SceneScores[i]);
+    zf.Finish();
+}
+
+void FFMS_VideoSource::ReadSceneScores(const char *SceneFile) {
+    ZipFile zf(SceneFile, "rb");
+    if (zf.Read<uint32_t>() != SCENEID || zf.Read<uint16_t>() != SCENE_VERSION)
+        throw FFMS_Exception(FFMS_ERROR_PARSER, FFMS_ERROR_FILE_READ,
+            std::string("'") + SceneFile + "' is not a valid scene score file");
+
+    uint8_t Digest[20];
+    int64_t Filesize = zf.Read<int64_t>();
+    zf.Read(Digest, sizeof(Digest));
+    uint32_t Track = zf.Read<uint32_t>();
+    uint32_t NumFrames = zf.Read<uint32_t>();
+    if (Filesize != SourceFilesize || memcmp(Digest, SourceDigest, sizeof(Digest)) ||
+        Track != static_cast<uint32_t>(VideoTrack) || NumFrames != Frames.size())
+        throw FFMS_Exception(FFMS_ERROR_INDEX, FFMS_ERROR_FILE_MISMATCH,
+            std::string("'") + SceneFile + "' does not belong to this video track");
+
+    SceneScores.resize(Frames.size(), -1);
+    for (size_t i = 0; i < NumFrames; i++) {
+        float Score = zf.Read<float>();
+        if (Score >= 0)
+            SceneScores[i] = Score;
+    }
+}
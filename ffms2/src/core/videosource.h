@@ -69,9 +69,26 @@ private:
     AVColorRange InputColorRange = AVCOL_RANGE_UNSPECIFIED;
     AVColorSpace InputColorSpace = AVCOL_SPC_UNSPECIFIED;
 
+    AVBufferRef *SWSFrameBuffer = nullptr;
     uint8_t *SWSFrameData[4] = {};
     int SWSFrameLinesize[4] = {};
 
+    bool TensorOutputSet = false;
+    FFMS_TensorOptions TensorOptions = {};
+    SwsContext *TensorSWS = nullptr;
+    AVBufferRef *TensorFrameBuffer = nullptr;
+    uint8_t *TensorFrameData[4] = {};
+    int TensorFrameLinesize[4] = {};
+    int TensorFrameWidth = -1;
+    int TensorFrameHeight = -1;
+    AVPixelFormat TensorFramePixelFormat = AV_PIX_FMT_NONE;
+
+    bool SceneDetection = false;
+    std::vector<float> SceneScores;
+    std::vector<uint8_t> SceneThumb;
+    std::vector<uint8_t> PrevSceneThumb;
+    int PrevSceneFrame = -1;
+
     void DetectInputFormat();
     bool HasPendingDelayedFrames();
 
@@ -80,7 +97,10 @@ private:
     AVFrame *DecodeFrame = nullptr;
     AVFrame *LastDecodedFrame = nullptr;
     int LastFrameNum = 0;
+    bool OutputPending = false;
     FFMS_Index &Index;
+    int64_t SourceFilesize;
+    uint8_t SourceDigest[20];
     FFMS_Track Frames;
     int VideoTrack;
     int CurrentFrame = 1;
@@ -90,9 +110,16 @@ private:
     int SeekMode;
     bool SeekByPos = false;
     int PosOffset = 0;
+    int SeekCount = 0;
 
     void ReAdjustOutputFormat(AVFrame *Frame);
     FFMS_Frame *OutputFrame(AVFrame *Frame);
+    void ReAdjustTensorFormat(AVFrame *Frame);
+    void OutputTensor(AVFrame *Frame, void *Buf);
+    void DecodeToFrame(int n);
+    int ClosestVisibleFrame(int64_t PTS) const;
+    bool IsSeekableKeyFrame(int n) const;
+    void AnalyzeFrame(int n);
     void SetVideoProperties();
     bool DecodePacket(AVPacket *Packet);
     void DecodeNextFrame(int64_t &PTS, int64_t &Pos);
@@ -106,6 +133,7 @@ public:
     ~FFMS_VideoSource();
     const FFMS_VideoProperties& GetVideoProperties() { return VP; }
     FFMS_Track *GetTrack() { return &Frames; }
+    int GetSeekCount() const { return SeekCount; }
     FFMS_Frame *GetFrame(int n);
     void GetFrameCheck(int n);
     FFMS_Frame *GetFrameByTime(double Time);
@@ -113,6 +141,16 @@ public:
     void ResetOutputFormat();
     void SetInputFormat(int ColorSpace, int ColorRange, AVPixelFormat Format);
     void ResetInputFormat();
+    void SetTensorOutput(const FFMS_TensorOptions &Options);
+    size_t GetTensorSize() const;
+    void GetFrameTensor(int n, void *Buf);
+    void GetFrameTensorBatch(const int *FrameNumbers, int NumFrames, void *Buf);
+    std::vector<int> PlanSampleFrames(int Count, int Stride, int Policy, int Tolerance) const;
+    void SampleFrames(int Count, int Stride, int Policy, int Tolerance, TFrameSampleCallback SC, void *SCPrivate);
+    void SetSceneDetection(bool Enable);
+    int GetSceneScores(float *Scores, int NumScores) const;
+    void WriteSceneScores(const char *SceneFile) const;
+    void ReadSceneScores(const char *SceneFile);
 };
 
 #endif
@@ -0,0 +1,119 @@
+// Batch indexer for ffms2.
+//
+// Indexes every file given on the command line, or listed one per line in a
+// list file, on a pool of worker threads and writes an .ffindex next to each
+// of them. Failures are reported per file without stopping the batch, and a
+// summary with the aggregate throughput is printed to stdout as JSON.
+//
+//     ffms2_index [--threads N] [--audio] [--list FILE] [FILE...]
+
+#include <ffms.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+struct IndexOptions {
+    int  threads = 0;
+    bool audio   = false;
+};
+
+struct BatchStats {
+    const std::vector<const char *> *files = nullptr;
+    int     indexed  = 0;
+    int     failed   = 0;
+    int64_t bytes    = 0;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static int FFMS_CC on_file_done(int _file, int64_t _bytes, double _seconds, const FFMS_ErrorInfo *_err, void *_private)
+{
+    BatchStats *stats = static_cast<BatchStats *>(_private);
+    const char *path  = (*stats->files)[_file];
+    if (_err->ErrorType == FFMS_ERROR_SUCCESS) {
+        stats->indexed++;
+        stats->bytes += _bytes;
+        fprintf(stderr, "%s: %.1f MB in %.2f s\n", path, _bytes / (1024.0 * 1024.0), _seconds);
+    } else {
+        stats->failed++;
+        fprintf(stderr, "%s: failed (%d, %d): %s\n", path, _err->ErrorType, _err->SubType, _err->Buffer);
+    }
+    return 0;
+}
+
+static bool read_list(const char *_path, std::vector<std::string> &_out)
+{
+    std::ifstream in(_path);
+    if (!in)
+        return false;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (!line.empty())
+            _out.push_back(line);
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    IndexOptions             opts;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            opts.threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--audio"))
+            opts.audio = true;
+        else if (!strcmp(argv[i], "--list") && i + 1 < argc) {
+            if (!read_list(argv[++i], paths)) {
+                fprintf(stderr, "can't read %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (argv[i][0] != '-')
+            paths.push_back(argv[i]);
+        else {
+            fprintf(stderr, "usage: %s [--threads N] [--audio] [--list FILE] [FILE...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    FFMS_Init(0, 0);
+    FFMS_SetLogLevel(FFMS_LOG_ERROR);
+
+    std::vector<const char *> files;
+    for (const std::string &path : paths)
+        files.push_back(path.c_str());
+
+    BatchStats stats;
+    stats.files = &files;
+
+    char           msg[1024];
+    FFMS_ErrorInfo err;
+    err.Buffer     = msg;
+    err.BufferSize = sizeof(msg);
+
+    Clock::time_point start = Clock::now();
+    int ret = FFMS_IndexFiles(files.data(), nullptr, (int)files.size(), opts.audio, FFMS_IEH_CLEAR_TRACK,
+                              opts.threads, on_file_done, &stats, &err);
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    if (ret != FFMS_ERROR_SUCCESS)
+        fprintf(stderr, "batch failed: %s\n", msg);
+
+    printf("{\n");
+    printf("  \"files\": %d,\n", (int)files.size());
+    printf("  \"indexed\": %d,\n", stats.indexed);
+    printf("  \"failed\": %d,\n", stats.failed);
+    printf("  \"bytes\": %lld,\n", (long long)stats.bytes);
+    printf("  \"seconds\": %.6f,\n", elapsed);
+    printf("  \"mb_per_second\": %.3f,\n", elapsed > 0 ? stats.bytes / elapsed / (1024.0 * 1024.0) : 0.0);
+    printf("  \"files_per_second\": %.3f\n", elapsed > 0 ? stats.indexed / elapsed : 0.0);
+    printf("}\n");
+    return ret == FFMS_ERROR_SUCCESS && stats.failed == 0 ? 0 : 1;
+}
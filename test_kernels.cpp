@@ -0,0 +1,418 @@
+// Checks the vectorized kernels in the library against plain reference
+// implementations, and the sample converters against swresample, so that a
+// mismatch between the SIMD and scalar paths fails the build's test step.
+
+#include <ffms.h>
+#include <audioconvert.h>
+#include <spectrogram.h>
+#include <tensor.h>
+
+extern "C" {
+#include <libavutil/channel_layout.h>
+#include <libavutil/opt.h>
+#include <libswresample/swresample.h>
+}
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static int Failures = 0;
+
+#define CHECK(Cond, ...) do { \
+    if (!(Cond)) { \
+        ++Failures; \
+        fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+        fprintf(stderr, __VA_ARGS__); \
+        fprintf(stderr, "\n"); \
+    } \
+} while (0)
+
+static std::mt19937 Random(12345);
+
+// Sample values which hit rounding ties, clipping and s32 overflow, followed
+// by random ones
+static void FillSamples(AVSampleFormat Format, uint8_t *Dst, size_t Count) {
+    std::uniform_int_distribution<int> Byte(0, 255);
+    std::uniform_int_distribution<int32_t> Int32(INT32_MIN, INT32_MAX);
+    std::uniform_real_distribution<float> Float(-1.2f, 1.2f);
+    static const float SpecialFloats[] = {
+        0.f, 1.f, -1.f, 0.99999994f, -0.99999994f, 1.5f, -1.5f, 1e9f, -1e9f,
+        0.5f / 32768, 1.5f / 32768, 2.5f / 32768, -0.5f / 32768, -1.5f / 32768,
+        32767.5f / 32768, -32768.5f / 32768, 1e-10f,
+    };
+    static const int16_t SpecialShorts[] = { 0, 1, -1, 32767, -32768 };
+    static const int32_t SpecialInts[] = { 0, 1, -1, INT32_MAX, INT32_MIN, 32767, -32768, 65535, -65536 };
+
+    switch (av_get_packed_sample_fmt(Format)) {
+    case AV_SAMPLE_FMT_U8:
+        for (size_t i = 0; i < Count; i++)
+            Dst[i] = static_cast<uint8_t>(Byte(Random));
+        break;
+    case AV_SAMPLE_FMT_S16: {
+        int16_t *D = reinterpret_cast<int16_t *>(Dst);
+        for (size_t i = 0; i < Count; i++)
+            D[i] = i < sizeof(SpecialShorts) / sizeof(*SpecialShorts) ? SpecialShorts[i] : static_cast<int16_t>(Int32(Random) >> 16);
+        break;
+    }
+    case AV_SAMPLE_FMT_S32: {
+        int32_t *D = reinterpret_cast<int32_t *>(Dst);
+        for (size_t i = 0; i < Count; i++)
+            D[i] = i < sizeof(SpecialInts) / sizeof(*SpecialInts) ? SpecialInts[i] : Int32(Random);
+        break;
+    }
+    case AV_SAMPLE_FMT_FLT: {
+        float *D = reinterpret_cast<float *>(Dst);
+        for (size_t i = 0; i < Count; i++)
+            D[i] = i < sizeof(SpecialFloats) / sizeof(*SpecialFloats) ? SpecialFloats[i] : Float(Random);
+        break;
+    }
+    case AV_SAMPLE_FMT_DBL: {
+        double *D = reinterpret_cast<double *>(Dst);
+        for (size_t i = 0; i < Count; i++)
+            D[i] = Float(Random);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// Buffers for Count samples of Channels channels, with one pointer per
+// plane. Planes are filled separately so that the special values show up
+// in every channel.
+struct SampleBuffer {
+    std::vector<std::vector<uint8_t>> Planes;
+    std::vector<uint8_t *> Pointers;
+
+    SampleBuffer(AVSampleFormat Format, int Channels, int Count) {
+        const bool Planar = !!av_sample_fmt_is_planar(Format);
+        const int NumPlanes = Planar ? Channels : 1;
+        const size_t PlaneSamples = static_cast<size_t>(Count) * (Planar ? 1 : Channels);
+        Planes.resize(NumPlanes);
+        for (auto &Plane : Planes) {
+            Plane.resize(PlaneSamples * av_get_bytes_per_sample(Format));
+            Pointers.push_back(Plane.data());
+        }
+    }
+
+    void Fill(AVSampleFormat Format) {
+        for (auto &Plane : Planes)
+            FillSamples(Format, Plane.data(), Plane.size() / av_get_bytes_per_sample(Format));
+    }
+};
+
+static bool ConvertWithSwr(AVSampleFormat In, AVSampleFormat Out, int Channels, int Count, SampleBuffer &Src, SampleBuffer &Dst) {
+    SwrContext *Context = swr_alloc();
+    const int64_t Layout = av_get_default_channel_layout(Channels);
+    av_opt_set_int(Context, "in_channel_layout", Layout, 0);
+    av_opt_set_int(Context, "out_channel_layout", Layout, 0);
+    av_opt_set_int(Context, "in_sample_rate", 48000, 0);
+    av_opt_set_int(Context, "out_sample_rate", 48000, 0);
+    av_opt_set_sample_fmt(Context, "in_sample_fmt", In, 0);
+    av_opt_set_sample_fmt(Context, "out_sample_fmt", Out, 0);
+    bool Ok = swr_init(Context) >= 0 &&
+        swr_convert(Context, Dst.Pointers.data(), Count, const_cast<const uint8_t **>(Src.Pointers.data()), Count) == Count;
+    swr_free(&Context);
+    return Ok;
+}
+
+static void TestSampleConverters() {
+    static const AVSampleFormat Formats[] = {
+        AV_SAMPLE_FMT_U8, AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_S32, AV_SAMPLE_FMT_FLT, AV_SAMPLE_FMT_DBL,
+        AV_SAMPLE_FMT_U8P, AV_SAMPLE_FMT_S16P, AV_SAMPLE_FMT_S32P, AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_DBLP,
+    };
+    // Odd counts leave a scalar tail after the vector loops, and more than
+    // 256 samples spans several chunks of the layout changing converters
+    static const int Channels[] = { 1, 2, 3, 6 };
+    static const int Counts[] = { 1, 7, 1031 };
+
+    int Tested = 0;
+    for (AVSampleFormat In : Formats) {
+        for (AVSampleFormat Out : Formats) {
+            if (In == Out)
+                continue;
+            SampleConverter Converter = GetSampleConverter(In, Out);
+            if (!Converter)
+                continue;
+            ++Tested;
+
+            for (int Ch : Channels) {
+                for (int Count : Counts) {
+                    SampleBuffer Src(In, Ch, Count);
+                    SampleBuffer Expected(Out, Ch, Count);
+                    SampleBuffer Actual(Out, Ch, Count);
+                    Src.Fill(In);
+
+                    if (!ConvertWithSwr(In, Out, Ch, Count, Src, Expected)) {
+                        CHECK(false, "swresample failed for %s -> %s", av_get_sample_fmt_name(In), av_get_sample_fmt_name(Out));
+                        continue;
+                    }
+                    Converter(Src.Pointers.data(), Actual.Pointers.data(), Ch, Count);
+
+                    for (size_t p = 0; p < Expected.Planes.size(); p++) {
+                        const auto &E = Expected.Planes[p];
+                        const auto &A = Actual.Planes[p];
+                        size_t Mismatch = std::mismatch(E.begin(), E.end(), A.begin()).first - E.begin();
+                        CHECK(Mismatch == E.size(), "%s -> %s with %d channels and %d samples differs from swresample in plane %d at byte %d",
+                            av_get_sample_fmt_name(In), av_get_sample_fmt_name(Out), Ch, Count, static_cast<int>(p), static_cast<int>(Mismatch));
+                    }
+                }
+            }
+        }
+    }
+    CHECK(Tested > 0, "no sample converters found");
+}
+
+static float HalfToFloat(uint16_t Half) {
+    const int Sign = Half >> 15;
+    const int Exponent = (Half >> 10) & 0x1F;
+    const int Mantissa = Half & 0x3FF;
+    float Value;
+    if (Exponent == 0)
+        Value = std::ldexp(static_cast<float>(Mantissa), -24);
+    else if (Exponent == 31)
+        Value = Mantissa ? NAN : INFINITY;
+    else
+        Value = std::ldexp(static_cast<float>(Mantissa + 1024), Exponent - 25);
+    return Sign ? -Value : Value;
+}
+
+// The float16 conversion rounds to nearest even, so the result must be
+// closer than both neighbouring halves or tie with one and be even, and
+// everything from 65520 up overflows to infinity
+static bool IsNearestHalf(float Value, uint16_t Half) {
+    if (std::isnan(Value))
+        return (Half & 0x7FFF) > 0x7C00;
+    if ((Half >> 15) != (std::signbit(Value) ? 1 : 0))
+        return Value == 0 && (Half & 0x7FFF) == 0;
+    if (std::fabs(Value) >= 65520.f)
+        return (Half & 0x7FFF) == 0x7C00;
+    const float Error = std::fabs(HalfToFloat(Half) - Value);
+    for (int Step : { -1, 1 }) {
+        uint16_t Neighbour = static_cast<uint16_t>(Half + Step);
+        if ((Neighbour & 0x7FFF) >= 0x7C00 || ((Neighbour ^ Half) & 0x8000))
+            continue;
+        const float NeighbourError = std::fabs(HalfToFloat(Neighbour) - Value);
+        if (NeighbourError < Error || (NeighbourError == Error && (Half & 1)))
+            return false;
+    }
+    return true;
+}
+
+static void TestTensor() {
+    // Widths which leave tails after the 16 pixel vector loop
+    static const int Widths[] = { 1, 15, 16, 37 };
+    const int Height = 5;
+
+    for (int Width : Widths) {
+        const int Linesize[3] = { Width + 3, Width + 16, Width };
+        std::vector<uint8_t> Data[3];
+        const uint8_t *Planes[3];
+        std::uniform_int_distribution<int> Byte(0, 255);
+        for (int c = 0; c < 3; c++) {
+            Data[c].resize(static_cast<size_t>(Linesize[c]) * Height);
+            for (auto &v : Data[c])
+                v = static_cast<uint8_t>(Byte(Random));
+            Data[c][0] = 0;
+            Data[c][1 % Data[c].size()] = 255;
+            Planes[c] = Data[c].data();
+        }
+
+        for (FFMS_TensorLayout Layout : { FFMS_TENSOR_LAYOUT_CHW, FFMS_TENSOR_LAYOUT_HWC }) {
+            for (FFMS_TensorDataType Type : { FFMS_TENSOR_FLOAT32, FFMS_TENSOR_FLOAT16 }) {
+                FFMS_TensorOptions Options = {};
+                Options.Width = Width;
+                Options.Height = Height;
+                Options.Layout = Layout;
+                Options.DataType = Type;
+                Options.Scale = 1.f / 255;
+                const float Mean[3] = { 0.485f, 0.456f, 0.406f };
+                const float Std[3] = { 0.229f, 0.224f, 0.225f };
+                std::copy(Mean, Mean + 3, Options.Mean);
+                std::copy(Std, Std + 3, Options.Std);
+
+                const size_t Elements = static_cast<size_t>(Width) * Height * 3;
+                CHECK(GetTensorFrameSize(Options) == Elements * (Type == FFMS_TENSOR_FLOAT16 ? 2 : 4), "wrong tensor frame size");
+                std::vector<uint8_t> Out(GetTensorFrameSize(Options));
+                WriteTensor(Planes, Linesize, Options, Out.data());
+
+                for (int c = 0; c < 3; c++) {
+                    const float Mul = Options.Scale / Std[c];
+                    const float Add = -Mean[c] / Std[c];
+                    for (int y = 0; y < Height; y++) {
+                        for (int x = 0; x < Width; x++) {
+                            const float Expected = Data[c][static_cast<size_t>(y) * Linesize[c] + x] * Mul + Add;
+                            const size_t Index = Layout == FFMS_TENSOR_LAYOUT_CHW
+                                ? (static_cast<size_t>(c) * Height + y) * Width + x
+                                : (static_cast<size_t>(y) * Width + x) * 3 + c;
+                            if (Type == FFMS_TENSOR_FLOAT32) {
+                                const float Actual = reinterpret_cast<const float *>(Out.data())[Index];
+                                CHECK(std::fabs(Actual - Expected) <= 1e-6f * std::max(1.f, std::fabs(Expected)),
+                                    "float32 tensor %dx%d layout %d channel %d at (%d, %d): %g, expected %g",
+                                    Width, Height, Layout, c, x, y, Actual, Expected);
+                            } else {
+                                const uint16_t Actual = reinterpret_cast<const uint16_t *>(Out.data())[Index];
+                                CHECK(IsNearestHalf(Expected, Actual),
+                                    "float16 tensor %dx%d layout %d channel %d at (%d, %d): %04x for %g",
+                                    Width, Height, Layout, c, x, y, Actual, Expected);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Rounding, subnormals and overflow of the float16 conversion on their own
+    static const float Values[] = {
+        0.f, -0.f, 1.f, 65504.f, 65519.f, 65520.f, 1e6f, -1e6f, 6.1035156e-5f, 5.9604645e-8f,
+        2.9802322e-8f, 8.940697e-8f, 1.0009766f, 1.00048828125f, 1.00146484375f, NAN,
+    };
+    const int Count = sizeof(Values) / sizeof(*Values);
+    FFMS_TensorOptions Options = {};
+    Options.Width = Count;
+    Options.Height = 1;
+    Options.Layout = FFMS_TENSOR_LAYOUT_CHW;
+    Options.DataType = FFMS_TENSOR_FLOAT16;
+    // Scale 0 turns every channel into -Mean / Std = Value
+    for (int i = 0; i < Count; i++) {
+        for (int c = 0; c < 3; c++) {
+            Options.Mean[c] = -Values[i];
+            Options.Std[c] = 1.f;
+        }
+        std::vector<uint8_t> Pixels(Count, 0);
+        const uint8_t *Planes[3] = { Pixels.data(), Pixels.data(), Pixels.data() };
+        const int Linesize[3] = { Count, Count, Count };
+        std::vector<uint16_t> Out(static_cast<size_t>(Count) * 3);
+        WriteTensor(Planes, Linesize, Options, Out.data());
+        CHECK(IsNearestHalf(Values[i], Out[i]), "float16 conversion of %g gave %04x", Values[i], Out[i]);
+    }
+}
+
+// Straightforward O(N^2) DFT power spectrum of a Hann windowed frame
+static std::vector<double> ReferencePower(const std::vector<float> &Samples) {
+    const size_t N = Samples.size();
+    const double Pi = 3.14159265358979323846;
+    std::vector<double> Power(N / 2 + 1);
+    for (size_t k = 0; k <= N / 2; k++) {
+        double Re = 0, Im = 0;
+        for (size_t n = 0; n < N; n++) {
+            double Windowed = Samples[n] * (0.5 - 0.5 * std::cos(2 * Pi * n / N));
+            Re += Windowed * std::cos(2 * Pi * k * n / N);
+            Im -= Windowed * std::sin(2 * Pi * k * n / N);
+        }
+        Power[k] = Re * Re + Im * Im;
+    }
+    return Power;
+}
+
+static double HzToMel(double Hz) {
+    return 2595. * std::log10(1. + Hz / 700.);
+}
+
+static void TestSpectrogram() {
+    const int SampleRate = 16000;
+    std::normal_distribution<float> Noise(0.f, 0.1f);
+
+    // Sizes below and above the four wide vector butterflies
+    for (int N : { 16, 64, 1024 }) {
+        std::vector<float> Samples(N);
+        for (int i = 0; i < N; i++)
+            Samples[i] = 0.5f * static_cast<float>(std::sin(2 * 3.14159265358979323846 * 440. * i / SampleRate)) + Noise(Random);
+        const std::vector<double> Power = ReferencePower(Samples);
+
+        FFMS_SpectrogramOptions Options = {};
+        Options.WindowSize = N;
+        Options.HopSize = N / 2;
+
+        // Magnitudes
+        {
+            Spectrogram Spec(Options, SampleRate);
+            CHECK(Spec.GetBins() == N / 2 + 1, "wrong number of bins for N = %d", N);
+            std::vector<float> Out(N / 2 + 1);
+            Spec.ComputeFrame(Samples.data(), Out.data());
+            double Max = 0;
+            for (double p : Power)
+                Max = std::max(Max, std::sqrt(p));
+            for (int k = 0; k <= N / 2; k++) {
+                const double Expected = std::sqrt(Power[k]);
+                CHECK(std::fabs(Out[k] - Expected) <= 1e-4 * Max,
+                    "N = %d bin %d magnitude %g, expected %g", N, k, Out[k], Expected);
+            }
+        }
+
+        // Log-mel energies with triangular filters evenly spaced on the mel scale
+        Options.MelBands = N >= 64 ? 8 : 2;
+        Options.MinFrequency = 100.f;
+        {
+            Spectrogram Spec(Options, SampleRate);
+            CHECK(Spec.GetBins() == Options.MelBands, "wrong number of mel bands for N = %d", N);
+            std::vector<float> Out(Options.MelBands);
+            Spec.ComputeFrame(Samples.data(), Out.data());
+
+            const double MinMel = HzToMel(Options.MinFrequency);
+            const double MaxMel = HzToMel(SampleRate / 2.);
+            for (int m = 0; m < Options.MelBands; m++) {
+                double Edges[3];
+                for (int e = 0; e < 3; e++) {
+                    const double Mel = MinMel + (MaxMel - MinMel) * (m + e) / (Options.MelBands + 1);
+                    Edges[e] = 700. * (std::pow(10., Mel / 2595.) - 1.);
+                }
+                double Energy = 0;
+                for (int k = 0; k <= N / 2; k++) {
+                    const double f = static_cast<double>(k) * SampleRate / N;
+                    double Weight = f <= Edges[1] ? (f - Edges[0]) / (Edges[1] - Edges[0]) : (Edges[2] - f) / (Edges[2] - Edges[1]);
+                    Energy += std::max(Weight, 0.) * Power[k];
+                }
+                const double Expected = std::log(std::max(Energy, 1e-10));
+                CHECK(std::fabs(Out[m] - Expected) <= 1e-3 * std::max(1., std::fabs(Expected)),
+                    "N = %d mel band %d log energy %g, expected %g", N, m, Out[m], Expected);
+            }
+        }
+    }
+
+    // Down-mixing of every supported format
+    const int Channels = 3;
+    const size_t Count = 37;
+    for (AVSampleFormat Format : { AV_SAMPLE_FMT_U8, AV_SAMPLE_FMT_S16P, AV_SAMPLE_FMT_S32, AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_DBL }) {
+        SampleBuffer Src(Format, Channels, static_cast<int>(Count));
+        Src.Fill(Format);
+        SampleBuffer Float(AV_SAMPLE_FMT_FLTP, Channels, static_cast<int>(Count));
+        if (!ConvertWithSwr(Format, AV_SAMPLE_FMT_FLTP, Channels, static_cast<int>(Count), Src, Float)) {
+            CHECK(false, "swresample failed for %s -> fltp", av_get_sample_fmt_name(Format));
+            continue;
+        }
+
+        // Planar input has its planes PlaneSize bytes apart in one buffer
+        std::vector<uint8_t> Contiguous;
+        for (auto &Plane : Src.Planes)
+            Contiguous.insert(Contiguous.end(), Plane.begin(), Plane.end());
+        std::vector<float> Mono(Count);
+        MixToMono(Contiguous.data(), Src.Planes[0].size(), Format, Channels, Count, Mono.data());
+        for (size_t i = 0; i < Count; i++) {
+            float Expected = 0;
+            for (int c = 0; c < Channels; c++)
+                Expected += reinterpret_cast<const float *>(Float.Pointers[c])[i];
+            Expected /= Channels;
+            CHECK(std::fabs(Mono[i] - Expected) <= 1e-5f, "%s mixed to mono at %d: %g, expected %g",
+                av_get_sample_fmt_name(Format), static_cast<int>(i), Mono[i], Expected);
+        }
+    }
+}
+
+int main() {
+    TestSampleConverters();
+    TestTensor();
+    TestSpectrogram();
+
+    if (Failures) {
+        fprintf(stderr, "%d checks failed\n", Failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}